@@ -0,0 +1,4535 @@
+#include <string.h>
+
+#include "compiler.h"
+#include "exporter.h"
+#include "math.h"
+#include "platform.h"
+#include "runtime.h"
+#include "screen.h"
+#include "statements.h"
+
+// 6502 instructions.
+#define I_ORA_ZPG 0x05
+#define I_PHP 0x08
+#define I_ASL_A 0x0A
+#define I_BPL_REL 0x10
+#define I_CLC 0x18
+#define I_JSR 0x20
+#define I_ROL_ZPG 0x26
+#define I_PLP 0x28
+#define I_AND_IMM 0x29
+#define I_ROL_A 0x2A
+#define I_BIT_ABS 0x2C
+#define I_BMI_REL 0x30
+#define I_SEC 0x38
+#define I_EOR_ZPG 0x45
+#define I_PHA 0x48
+#define I_EOR_IMM 0x49
+#define I_LSR_A 0x4A
+#define I_JMP_ABS 0x4C
+#define I_RTS 0x60
+#define I_ADC_ZPG 0x65
+#define I_PLA 0x68
+#define I_ADC_IMM 0x69
+#define I_JMP_IND 0x6C
+#define I_ADC_ZPG_Y 0x71
+#define I_STA_ZPG 0x85
+#define I_STX_ZPG 0x86
+#define I_DEY 0x88
+#define I_TXA 0x8A
+#define I_STA_ABS 0x8D
+#define I_STX_ABS 0x8E
+#define I_BCC_REL 0x90
+#define I_STA_IND_Y 0x91
+#define I_TYA 0x98
+#define I_STA_ABS_Y 0x99
+#define I_LDY_IMM 0xA0
+#define I_LDX_IMM 0xA2
+#define I_LDY_ZPG 0xA4
+#define I_LDA_ZPG 0xA5
+#define I_LDX_ZPG 0xA6
+#define I_TAY 0xA8
+#define I_LDA_IMM 0xA9
+#define I_TAX 0xAA
+#define I_LDA_ABS 0xAD
+#define I_LDX_ABS 0xAE
+#define I_BCS_REL 0xB0
+#define I_LDA_IND_Y 0xB1
+#define I_LDA_ABS_Y 0xB9
+#define I_TSX 0xBA
+#define I_LDA_ABS_X 0xBD
+#define I_LDX_ABS_Y 0xBE
+#define I_CPY_IMM 0xC0
+#define I_CMP_ZPG 0xC5
+#define I_DEC_ZPG 0xC6
+#define I_INY 0xC8
+#define I_CMP_IMM 0xC9
+#define I_DEX 0xCA
+#define I_CMP_ABS 0xCD
+#define I_BNE_REL 0xD0
+#define I_CPX_IMM 0xE0
+#define I_INC_ZPG 0xE6
+#define I_INX 0xE8
+#define I_SBC_IMM 0xE9
+#define I_CPX_ABS 0xEC
+#define I_BEQ_REL 0xF0
+
+// Operators. These encode both the operator (high nybble) and the precedence
+// (low nybble). Lower precedence has a lower low nybble value. For example,
+// OP_ADD (0x99) and OP_SUB (0xA9) have the same precedence (9). By convention
+// the precedence is the value of the lowest-valued operator in its class
+// (OP_ADD = 0x99), but only the relative values of precedence matter. All
+// of these are left-associative, as in AppleSoft BASIC. (Even though
+// exponentiation really should be right-associative.)
+#define OP_PRECEDENCE(op) ((op) & 0x0F)
+#define OP_OR 0x00
+#define OP_AND 0x11
+#define OP_NOT 0x22
+#define OP_LTE 0x33
+#define OP_GTE 0x43
+#define OP_EQ 0x55
+#define OP_NEQ 0x65
+#define OP_LT 0x75
+#define OP_GT 0x85
+#define OP_ADD 0x99
+#define OP_SUB 0xA9
+#define OP_MULT 0xBB
+#define OP_DIV 0xCB
+#define OP_MOD 0xDB
+#define OP_NEG 0xDD
+#define OP_EXP 0xEE
+#define OP_ABS 0xF0 // Functions. Applied at their closing parenthesis.
+#define OP_SGN 0xF1
+#define OP_SQR 0xF2
+#define OP_PEEK 0xF3
+#define OP_SCRN 0xF4 // Before the comma.
+#define OP_SCRN_XY 0xF5 // After the comma, X coordinate pushed.
+#define OP_RND 0xF6
+#define OP_ARRAY_DEREF 0xFB // Ignore precedence.
+#define OP_NO_OP 0xFC // Never on the stack.
+#define OP_CLOSE_PARENS 0xFD // Never on the stack.
+#define OP_OPEN_PARENS 0xFE // Ignore precedence.
+#define OP_INVALID 0xFF
+#define IS_FUNCTION_OP(op) ((op) >= OP_ABS && (op) <= OP_RND)
+
+// Maximum number of operators in the operator stack.
+#define MAX_OP_STACK 16
+
+// Maximum number of values on the expression stack, including AX.
+#define MAX_TYPE_STACK 16
+
+// Maximum number of forward GOTOs and GOSUBs.
+#define MAX_FORWARD_GOTO 32
+
+// Maximum number of line numbers in an ON statement, so that one past the
+// last index fits in a byte.
+#define MAX_ON_TARGETS 254
+
+// Lowest hardware stack pointer at which a GOSUB may still push its return
+// address, leaving room for the calls that statements in the subroutine make.
+#define MIN_GOSUB_STACK 0x40
+
+// Maximum number of variable increments tracked by range analysis.
+#define MAX_INCREMENTS 8
+
+// Largest constant power that's compiled to a chain of multiplies rather
+// than a call to the power routine.
+#define MAX_UNROLLED_POWER 8
+
+// Number of rows of low-res pixels, two per text row.
+#define GR_HEIGHT 48
+
+// Keyboard soft switches. The key has its high bit set while it's waiting,
+// and any access to the strobe clears it.
+#define KBD_KEY 0xC000
+#define KBD_STROBE 0xC010
+
+// Maximum number of DATA items, so that the index of the next one fits in Y.
+#define MAX_DATA 255
+
+// Test for whether a character is a digit.
+#define IS_DIGIT(ch) ((ch) >= '0' && (ch) <= '9')
+
+// Test for first and subsequent variable name letters.
+#define IS_FIRST_VARIABLE_LETTER(ch) ((ch) >= 'A' && (ch) <= 'Z')
+#define IS_SUBSEQUENT_VARIABLE_LETTER(ch) (IS_FIRST_VARIABLE_LETTER(ch) || IS_DIGIT(ch))
+
+// Test for the end of a statement.
+#define IS_END_OF_STATEMENT(ch) ((ch) == '\0' || (ch) == ':')
+
+// Kinds of simple operands. See Operand.
+#define OPERAND_NONE 0
+#define OPERAND_CONSTANT 1
+#define OPERAND_VARIABLE 2
+
+// How an increment or decrement is kept in range. See Increment.
+#define GUARD_NONE 0
+#define GUARD_BEFORE 1      // IF X < k THEN X = X + 1, or IF X > k THEN X = X - 1.
+#define GUARD_RESET_EQ 2    // X = X + 1 followed by IF X = k THEN X = c.
+#define GUARD_RESET_GTE 3   // X = X + 1 followed by IF X >= k THEN X = c.
+
+// Value used for "no variable" and "no increment" in range analysis.
+#define NO_INDEX 0xFF
+
+// Where the row offset of a two-dimensional array element is.
+#define ROW_NONE 0          // One-dimensional, or before the comma.
+#define ROW_CONSTANT 1      // Known at compile time, in row_offset.
+#define ROW_PUSHED 2        // On the cc65 stack.
+
+// Returned by get_stride_shift() for a stride that's not a power of two.
+#define NO_SHIFT 0xFF
+
+// Info for each "forward GOTO", which is a GOTO to a line that we've
+// not compiled yet.
+typedef struct {
+    // The line number the GOTO is on. This is for error messages.
+    uint16_t source_line_number;
+
+    // The line number it's trying to jump to.
+    uint16_t target_line_number;
+
+    // Where to fill in the low and high bytes of the target address. These
+    // are the operand of a JMP or JSR, or entries in an ON jump table.
+    uint8_t *address_low;
+    uint8_t *address_high;
+} ForwardGoto;
+
+// Range of values of an integer variable, found by range analysis before
+// compiling the stored program. A variable that stays in 0 to 255 is
+// compiled like a byte variable, and its high byte is always zero.
+typedef struct {
+    uint8_t low;
+    uint8_t high;
+
+    // Whether the variable might go outside 0 to 255.
+    uint8_t unbounded;
+} Range;
+
+// Compile-time info about an array variable.
+typedef struct {
+    // Number of DIM statements for the array in the stored program.
+    uint8_t dim_count;
+
+    // Number of elements if the DIM size is a constant, or 0. For a
+    // two-dimensional array, that's the number of rows times the stride.
+    uint16_t size;
+
+    // Number of columns of a two-dimensional array (its second DIM size
+    // plus one), or 0 for a one-dimensional array.
+    uint16_t columns;
+
+    // Number of elements from one row to the next. This is the number of
+    // columns, rounded up to a power of two if the array is allocated at
+    // compile time and there's room, so that the row index is shifted
+    // instead of multiplied.
+    uint16_t stride;
+
+    // Address of the array if it was allocated at compile time, or 0 if
+    // it's allocated at run time and its address is only in its variable.
+    uint8_t *address;
+} ArrayInfo;
+
+// A "X = X + 1" or "X = X - 1" statement found by range analysis.
+typedef struct {
+    // Index of the variable in g_variables.
+    uint8_t var;
+
+    // 1 or -1.
+    int8_t delta;
+
+    // One of the GUARD_ constants.
+    uint8_t guard;
+
+    // The value the guard compares against. For GUARD_BEFORE, the furthest
+    // the statement can take the variable.
+    int16_t limit;
+} Increment;
+
+// An array being dereferenced in an expression.
+typedef struct {
+    VarInfo *var;
+
+    // One of the ROW_ constants.
+    uint8_t row;
+
+    // Row index times stride, for ROW_CONSTANT.
+    uint16_t row_offset;
+} ArrayRef;
+
+// The simple operand (a constant or scalar variable) most recently loaded
+// into AX. An operator that consumes it can remove the load (and the push
+// of the previous value) and use the operand directly instead of going
+// through the cc65 stack.
+typedef struct {
+    // One of the OPERAND_ constants.
+    uint8_t kind;
+
+    // Constant value, or zero-page address of the variable.
+    uint16_t value;
+
+    // Address of the push of the previous value in AX, or 0 if there was none.
+    uint8_t *push;
+
+    // Address of the load.
+    uint8_t *load;
+
+    // Address just past the load. The operand is only in AX if nothing has
+    // been compiled since.
+    uint8_t *end;
+} Operand;
+
+// List of tokens. The token value is the index plus 0x80.
+static char *TOKEN[] = {
+    "HOME",
+    "PRINT",
+    "LIST",
+    "POKE",
+    "RUN",
+    "NEW",
+    "+",
+    "-",
+    "*",
+    "/",
+    "^",
+    "AND",
+    "OR",
+    ">",
+    "=",
+    "<",
+    "GOTO",
+    "IF",
+    "THEN",
+    "GR",
+    "TEXT",
+    "COLOR",
+    "PLOT",
+    "FOR",
+    "TO",
+    "STEP",
+    "NEXT",
+    "NOT",
+    "DIM",
+    "REM",
+    "CHECK",
+    "DATA",
+    "READ",
+    "RESTORE",
+    "GOSUB",
+    "RETURN",
+    "POP",
+    "ON",
+    "MOD",
+    "ABS",
+    "SGN",
+    "SQR",
+    "PEEK",
+    "CALL",
+    "FILL",
+    "MOVE",
+    "DRAW",
+    "SCRN",
+    "RND",
+    "GET",
+    "KEY",
+};
+static int16_t TOKEN_COUNT = sizeof(TOKEN)/sizeof(TOKEN[0]);
+
+// Compiled binary.
+uint8_t g_compiled[COMPILED_SIZE];
+uint8_t *g_c = g_compiled;
+
+// Stored program. Each line is:
+// - Pointer to next line (or zero if none).
+// - Two bytes for line number.
+// - Program line.
+// - Nul.
+// This is 1 KB on the 6502. Bigger pointers on the host get room for the
+// same lines.
+uint8_t g_program[256*LINE_TEXT_OFFSET];
+
+// Info about each compiled line.
+LineInfo g_line_info[MAX_LINES];
+uint8_t g_line_info_count;
+
+// Most recent simple operand.
+Operand g_operand;
+
+// Data types (DT_ constants) of the values on the expression stack. The
+// last one is the value in AX.
+uint8_t g_type_stack[MAX_TYPE_STACK];
+uint8_t g_type_stack_size;
+
+// Data type of the most recently compiled expression.
+uint8_t g_expression_type;
+
+// Operator stack, of the expression-evaluation routines. These are from the
+// OP_ constants.
+uint8_t g_op_stack[MAX_OP_STACK];
+uint8_t g_op_stack_size;
+
+// Arrays being dereferenced, one for each OP_ARRAY_DEREF on the operator
+// stack.
+ArrayRef g_array_stack[MAX_OP_STACK];
+uint8_t g_array_stack_size;
+
+// Range of each variable, by index in g_variables. Only meaningful for
+// integer scalars.
+Range g_range[MAX_VARIABLES];
+
+// Info for each array variable, by index in g_variables.
+ArrayInfo g_array_info[MAX_VARIABLES];
+
+// Number of words of g_arrays allocated at compile time.
+uint16_t g_static_array_words;
+
+// Whether to compile bounds checks of array indexes. Set by "RUN CHECK"
+// and kept for immediate mode.
+uint8_t g_check_bounds;
+
+// Line number of the line being compiled, for run-time errors.
+uint16_t g_line_number;
+
+// Table of DATA items in the compiled binary: the low bytes, then the
+// high bytes unless every item fits in a byte.
+uint8_t *g_data_table;
+uint8_t g_data_count;
+uint8_t g_data_bytes;
+
+// Smallest and largest DATA items, for range analysis.
+int16_t g_data_low;
+int16_t g_data_high;
+
+// Increments found by range analysis.
+Increment g_increment[MAX_INCREMENTS];
+uint8_t g_increment_count;
+
+// List of all forward GOTOs. These are packed at the beginning, with
+// g_forward_goto_count entries in use.
+ForwardGoto g_forward_goto[MAX_FORWARD_GOTO];
+uint8_t g_forward_goto_count;
+
+/**
+ * Print the tokenized string, with tokens displayed as their full text.
+ * Prints a newline at the end.
+ */
+static void print_detokenized(uint8_t *s) {
+    while (*s != '\0') {
+        if (*s >= 0x80) {
+            print_char(' ');
+            print((uint8_t *) TOKEN[*s - 0x80]);
+            print_char(' ');
+        } else {
+            print_char(*s);
+        }
+
+        s += 1;
+    }
+
+    print_char('\n');
+}
+
+/**
+ * Get the pointer to the next line in the stored program. Returns 0
+ * if we're at the end.
+ */
+static uint8_t *get_next_line(uint8_t *line) {
+    return *((uint8_t **) line);
+}
+
+/**
+ * Get the line number of a stored program line.
+ */
+static uint16_t get_line_number(uint8_t *line) {
+    return *((uint16_t *) (line + LINE_NUMBER_OFFSET));
+}
+
+/**
+ * Return a pointer to the end of the program. This is one byte PAST the
+ * last bytes in the program, which are two nuls. The "line" parameter is
+ * an optional starting point, to use as an optimization instead of starting
+ * from the beginning.
+ */
+static uint8_t *get_end_of_program(uint8_t *line) {
+    uint8_t *next_line;
+
+    if (line == 0) {
+        // Start at the beginning if not specified.
+        line = g_program;
+    }
+
+    while ((next_line = get_next_line(line)) != 0) {
+        line = next_line;
+    }
+
+    // Skip the null "next" pointer.
+    return line + LINE_NUMBER_OFFSET;
+}
+
+/**
+ * Clear the stored program.
+ */
+void new_statement(void) {
+    *((uint8_t **) g_program) = 0;
+}
+
+/**
+ * List the stored program.
+ */
+static void list_statement() {
+    uint8_t *line = g_program;
+    uint8_t *next_line;
+
+    print_newline();
+
+    while ((next_line = get_next_line(line)) != 0) {
+        print_uint(get_line_number(line));
+        print_char(' ');
+        print_detokenized(line + LINE_TEXT_OFFSET);
+
+        line = next_line;
+    }
+}
+
+/**
+ * If a starts with string b, returns the position in a after b. Else returns null.
+ */
+static uint8_t *skip_over(uint8_t *a, uint8_t *b) {
+    while (*a != '\0' && *b != '\0') {
+        if (*a != *b) {
+            // Doesn't start with b.
+            return 0;
+        }
+
+        a += 1;
+        b += 1;
+    }
+
+    // See if we're at the end of b.
+    return *b == '\0' ? a : 0;
+}
+
+/**
+ * Add a call to the 6502 address to the compiled buffer.
+ */
+static void add_call_address(uint16_t addr) {
+    g_c[0] = I_JSR;
+    g_c[1] = addr & 0xFF;
+    g_c[2] = addr >> 8;
+    g_c += 3;
+}
+
+/**
+ * Add a function call to the compiled buffer.
+ */
+static void add_call(void *function) {
+    add_call_address(ADDRESS(function));
+}
+
+/**
+ * Add a call to a runtime routine that takes a zero-page variable address
+ * and a line number inline after the JSR. The routine skips over them.
+ */
+static void add_call_with_var(void *function, uint8_t var_addr, uint16_t line_number) {
+    add_call(function);
+
+    g_c[0] = var_addr;
+    g_c[1] = line_number & 0xFF;
+    g_c[2] = line_number >> 8;
+    g_c += 3;
+}
+
+/**
+ * Add a call to a runtime routine that takes the line number being compiled
+ * inline after the JSR.
+ */
+static void add_call_with_line(void *function) {
+    add_call(function);
+
+    g_c[0] = g_line_number & 0xFF;
+    g_c[1] = g_line_number >> 8;
+    g_c += 2;
+}
+
+/**
+ * Add a function return to the compiled buffer.
+ */
+static void add_return() {
+    *g_c++ = I_RTS;
+}
+
+/**
+ * Add a jump that ends the compiled program, even from inside a subroutine.
+ */
+static void add_abort(void) {
+    uint8_t *c = g_c;
+    uint16_t addr = ADDRESS(abort_program);
+
+    c[0] = I_JMP_ABS;
+    c[1] = addr & 0xFF;
+    c[2] = addr >> 8;
+    g_c = c + 3;
+}
+
+/**
+ * Parse an unsigned integer, returning the value and moving the pointer
+ * past the end of the number. The pointer must already be at the beginning
+ * of the number.
+ */
+static uint16_t parse_uint16(uint8_t **s_ptr) {
+    uint16_t value = 0;
+    uint8_t *s = *s_ptr;
+
+    while (IS_DIGIT(*s)) {
+        value = value*10 + (*s - '0');
+        s += 1;
+    }
+
+    *s_ptr = s;
+
+    return value;
+}
+
+/**
+ * Parse the digits after a decimal point, returning the fraction in 256ths,
+ * rounded, and moving the pointer past the digits. The result can be 256
+ * if the fraction rounds up to one.
+ */
+static uint16_t parse_fraction(uint8_t **s_ptr) {
+    uint32_t numerator = 0;
+    uint32_t denominator = 1;
+    uint8_t *s = *s_ptr;
+
+    while (IS_DIGIT(*s)) {
+        // Further digits are beyond the precision of 8.8.
+        if (denominator < 100000L) {
+            numerator = numerator*10 + (*s - '0');
+            denominator *= 10;
+        }
+        s += 1;
+    }
+
+    *s_ptr = s;
+
+    return (numerator*256 + denominator/2)/denominator;
+}
+
+/**
+ * Generate code to put the value into AX.
+ */
+static void compile_load_ax(uint16_t value) {
+    g_c[0] = I_LDX_IMM;
+    g_c[1] = value >> 8;
+    g_c[2] = I_LDA_IMM;
+    g_c[3] = value & 0xFF;
+    g_c += 4;
+}
+
+/**
+ * Generate code to store AX to a zero-page word.
+ */
+static void compile_store_zero_page(uint8_t addr) {
+    g_c[0] = I_STA_ZPG;
+    g_c[1] = addr;
+    g_c[2] = I_STX_ZPG;
+    g_c[3] = addr + 1;
+    g_c += 4;
+}
+
+/**
+ * Generate code to load AX from a zero-page word.
+ */
+static void compile_load_zero_page(uint8_t addr) {
+    g_c[0] = I_LDA_ZPG;
+    g_c[1] = addr;
+    g_c[2] = I_LDX_ZPG;
+    g_c[3] = addr + 1;
+    g_c += 4;
+}
+
+/**
+ * Call before compiling a simple operand. Pushes the value in AX, if any.
+ */
+static void begin_operand(char have_value_in_ax) {
+    if (have_value_in_ax) {
+        g_operand.push = g_c;
+        add_call(pushax);
+    } else {
+        g_operand.push = 0;
+    }
+
+    g_operand.load = g_c;
+}
+
+/**
+ * Call after compiling the load of a simple operand into AX.
+ */
+static void end_operand(uint8_t kind, uint16_t value) {
+    g_operand.kind = kind;
+    g_operand.value = value;
+    g_operand.end = g_c;
+}
+
+/**
+ * Returns the kind of simple operand in AX, or OPERAND_NONE if AX holds
+ * anything else.
+ */
+static uint8_t get_operand_kind(void) {
+    return g_operand.end == g_c ? g_operand.kind : OPERAND_NONE;
+}
+
+/**
+ * Remove the compiled code of the right operand of a binary operator, if
+ * it's a simple operand, along with the push of the left operand. The left
+ * operand is then in AX and the right operand is described by g_operand.
+ * Returns whether successful.
+ */
+static uint8_t unload_operand(void) {
+    if (get_operand_kind() == OPERAND_NONE || g_operand.push == 0) {
+        return 0;
+    }
+
+    g_c = g_operand.push;
+    g_operand.kind = OPERAND_NONE;
+
+    return 1;
+}
+
+/**
+ * Returns whether the simple operand in AX, of the given type, is known to
+ * fit in a byte: a byte variable or a small integer constant.
+ */
+static uint8_t is_byte_operand(uint8_t type) {
+    uint8_t kind = get_operand_kind();
+
+    return (kind == OPERAND_VARIABLE && type == DT_BYTE) ||
+        (kind == OPERAND_CONSTANT && type != DT_FIXED && g_operand.value < 256);
+}
+
+/**
+ * Generate code to load Y with a constant or a byte variable.
+ */
+static void compile_load_y(uint8_t kind, uint8_t value) {
+    g_c[0] = kind == OPERAND_CONSTANT ? I_LDY_IMM : I_LDY_ZPG;
+    g_c[1] = value;
+    g_c += 2;
+}
+
+/**
+ * Find a variable by name. The buffer pointer must already be on the
+ * first letter of a variable. Only the first two letters are considered.
+ * Advances the pointer past the variable name (including letters after
+ * the first two). Returns the VarInfo structure, or 0 if we can't find
+ * the variable or create it.
+ */
+static VarInfo *find_variable(uint8_t **buffer) {
+    uint8_t *s = *buffer;
+    VarInfo *var = g_variables;
+    uint16_t name;
+    int16_t i;
+    uint8_t data_type;
+
+    // Pull out the variable name.
+    name = *s++;
+    if (IS_SUBSEQUENT_VARIABLE_LETTER(*s)) {
+        name |= *s++ << 8;
+    }
+    // Skip rest of name.
+    while (IS_SUBSEQUENT_VARIABLE_LETTER(*s)) {
+        s++;
+    }
+
+    // Determine data type based on the suffix.
+    if (*s == FIXED_SUFFIX) {
+        data_type = DT_FIXED;
+        s++;
+    } else if (*s == BYTE_SUFFIX) {
+        data_type = DT_BYTE;
+        s++;
+    } else {
+        data_type = DT_INT;
+    }
+
+    // Array if followed by an open parenthesis. Don't skip over it.
+    if (*s == '(') {
+        data_type |= DT_ARRAY;
+    }
+
+    // Look for our variable or the first unused slot.
+    for (i = 0; i < MAX_VARIABLES; i++, var++) {
+        if (var->name == 0) {
+            // First free entry. Allocate it.
+            var->name = name;
+            var->data_type = data_type;
+            break;
+        } else if (var->name == name && var->data_type == data_type) {
+            // Found it.
+            break;
+        }
+    }
+
+    if (i == MAX_VARIABLES) {
+        // Not found and can't create it.
+        var = 0;
+    } else {
+        // Advance pointer.
+        *buffer = s;
+    }
+
+    return var;
+}
+
+/**
+ * Get the zero page address of a VarInfo pointer's variable.
+ */
+static uint8_t get_var_address(VarInfo *var) {
+    return FIRST_VARIABLE + 2*(var - g_variables);
+}
+
+/**
+ * Get the data type that a variable is compiled as. Integer variables that
+ * range analysis found to stay in 0 to 255 are compiled as bytes.
+ */
+static uint8_t get_var_type(VarInfo *var) {
+    return var->data_type == DT_INT && !g_range[var - g_variables].unbounded ?
+        DT_BYTE : var->data_type;
+}
+
+/**
+ * Generate code to load a scalar variable into AX.
+ */
+static void compile_load_variable(uint8_t var_addr, uint8_t data_type) {
+    if (data_type == DT_BYTE) {
+        // Only the low byte is meaningful.
+        g_c[0] = I_LDA_ZPG;
+        g_c[1] = var_addr;
+        g_c[2] = I_LDX_IMM;
+        g_c[3] = 0;
+        g_c += 4;
+    } else {
+        compile_load_zero_page(var_addr);
+    }
+}
+
+/**
+ * Generate code to convert the value in AX from one data type to another.
+ * A constant operand is converted at compile time.
+ */
+static void compile_convert(uint8_t from, uint8_t to) {
+    register uint8_t *c;
+
+    // A byte in AX always has a zero high byte, so it's already an integer.
+    if (from == to || (from == DT_BYTE && to == DT_INT)) {
+        return;
+    }
+
+    if (get_operand_kind() == OPERAND_CONSTANT) {
+        uint16_t value = g_operand.value;
+
+        if (to == DT_FIXED) {
+            value <<= 8;
+        } else if (from == DT_FIXED) {
+            value = (uint16_t) ((int16_t) value >> 8);
+        }
+        if (to == DT_BYTE) {
+            value &= 0xFF;
+        }
+        g_c = g_operand.load;
+        compile_load_ax(value);
+        end_operand(OPERAND_CONSTANT, value);
+    } else if (to == DT_FIXED) {
+        // Integer to fixed: low byte becomes the integer part.
+        c = g_c;
+        c[0] = I_TAX;
+        c[1] = I_LDA_IMM;
+        c[2] = 0;
+        g_c = c + 3;
+    } else {
+        c = g_c;
+        if (from == DT_FIXED) {
+            // Integer part, which rounds down.
+            *c++ = I_TXA;
+        }
+        c[0] = I_LDX_IMM;
+        c[1] = 0;
+        c += 2;
+        if (to == DT_INT) {
+            // Sign-extend the integer part of a fixed-point value.
+            c[0] = I_CMP_IMM;
+            c[1] = 0x80;
+            c[2] = I_BCC_REL;
+            c[3] = 1;           // Skip DEX.
+            c[4] = I_DEX;
+            c += 5;
+        }
+        g_c = c;
+    }
+}
+
+/**
+ * Generate code to convert the integer at the top of the cc65 stack, the
+ * left operand of a binary operator, to fixed point. Preserves AX.
+ */
+static void compile_convert_left_to_fixed(void) {
+    register uint8_t *c = g_c;
+
+    c[0] = I_PHA;
+    c[1] = I_LDY_IMM;
+    c[2] = 0;
+    c[3] = I_LDA_IND_Y;         // Low byte becomes high byte.
+    c[4] = ZP_ADDRESS(sp);
+    c[5] = I_INY;
+    c[6] = I_STA_IND_Y;
+    c[7] = ZP_ADDRESS(sp);
+    c[8] = I_DEY;
+    c[9] = I_TYA;               // Low byte is zero.
+    c[10] = I_STA_IND_Y;
+    c[11] = ZP_ADDRESS(sp);
+    c[12] = I_PLA;
+    g_c = c + 13;
+}
+
+/**
+ * Find the address of a line in the compiled buffer, or 0 if not found.
+ */
+static uint8_t *find_line_address(uint16_t line_number) {
+    int i;
+
+    for (i = 0; i < g_line_info_count; i++) {
+        LineInfo *l = &g_line_info[i];
+
+        if (l->line_number == line_number) {
+            return l->code;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Push the data type of a value onto the type stack.
+ */
+static void push_type(uint8_t type) {
+    // TODO Check for g_type_stack overflow.
+    g_type_stack[g_type_stack_size++] = type;
+}
+
+/**
+ * Generate code to compare the byte in AX (whose high byte is zero) with a
+ * constant or byte variable of the given kind, leaving 1 or 0 in AX. The
+ * constant must be less than 255 for OP_GT and OP_LTE.
+ */
+static void compile_byte_compare(uint8_t op, uint8_t kind, uint8_t value) {
+    register uint8_t *c = g_c;
+    uint8_t invert;
+
+    if (op == OP_EQ || op == OP_NEQ) {
+        // Zero if equal, then carry clear if zero.
+        c[0] = kind == OPERAND_CONSTANT ? I_EOR_IMM : I_EOR_ZPG;
+        c[1] = value;
+        c[2] = I_CMP_IMM;
+        c[3] = 1;
+        c += 4;
+        invert = op == OP_EQ;
+    } else if ((op == OP_GT || op == OP_LTE) && kind == OPERAND_VARIABLE) {
+        // Compare the other way around, so carry is set if right >= left.
+        c[0] = I_STA_ZPG;
+        c[1] = ZP_ADDRESS(tmp1);
+        c[2] = I_LDA_ZPG;
+        c[3] = value;
+        c[4] = I_CMP_ZPG;
+        c[5] = ZP_ADDRESS(tmp1);
+        c += 6;
+        invert = op == OP_GT;
+    } else {
+        // Carry is set if left >= right. For a constant, left > k is
+        // left >= k + 1 and left <= k is left < k + 1.
+        if (op == OP_GT || op == OP_LTE) {
+            value += 1;
+        }
+        c[0] = kind == OPERAND_CONSTANT ? I_CMP_IMM : I_CMP_ZPG;
+        c[1] = value;
+        c += 2;
+        invert = op == OP_LT || op == OP_LTE;
+    }
+
+    // Carry into A. X is still zero.
+    c[0] = I_LDA_IMM;
+    c[1] = 0;
+    c[2] = I_ROL_A;
+    c += 3;
+    if (invert) {
+        c[0] = I_EOR_IMM;
+        c[1] = 1;
+        c += 2;
+    }
+
+    g_c = c;
+}
+
+/**
+ * Compile a comparison operator. A byte compared to a byte or a small
+ * constant is done inline in 8 bits, otherwise the runtime function is
+ * called.
+ */
+static void compile_compare(uint8_t op, uint8_t left_type, uint8_t right_type, void *function) {
+    uint8_t kind = get_operand_kind();
+    uint8_t value = g_operand.value;
+
+    if (left_type == DT_BYTE && is_byte_operand(right_type) &&
+            (kind == OPERAND_VARIABLE || value != 255 || (op != OP_GT && op != OP_LTE)) &&
+            unload_operand()) {
+
+        compile_byte_compare(op, kind, value);
+    } else {
+        add_call(function);
+    }
+}
+
+/**
+ * Get the address of an array if it was allocated at compile time, or 0.
+ */
+static uint8_t *get_array_address(VarInfo *var) {
+    return g_array_info[var - g_variables].address;
+}
+
+/**
+ * Returns whether an array was allocated at compile time with at most 256
+ * elements, so that any element is reached with the index in Y. The words
+ * of such an array are split into two planes, all the low bytes followed
+ * by all the high bytes, so that the index doesn't need doubling.
+ */
+static uint8_t is_small_array(VarInfo *var) {
+    ArrayInfo *a = &g_array_info[var - g_variables];
+
+    return a->address != 0 && a->size <= 256;
+}
+
+/**
+ * Generate code to put the address of an array element into AX. The
+ * integer index is in AX.
+ */
+static void compile_element_address(VarInfo *var) {
+    uint8_t var_addr = get_var_address(var);
+    uint16_t address = ADDRESS(get_array_address(var));
+    register uint8_t *c;
+
+    if (ELEMENT_TYPE(var->data_type) != DT_BYTE) {
+        // Double the index, since each entry takes two bytes.
+        add_call(aslax1);
+    }
+
+    // Add A to low byte of array address, from the array's variable or
+    // the fixed address.
+    c = g_c;
+    c[0] = I_CLC;
+    c[1] = address != 0 ? I_ADC_IMM : I_ADC_ZPG;
+    c[2] = address != 0 ? address & 0xFF : var_addr;
+    c[3] = I_PHA;
+
+    // Add X to high byte by array address.
+    c[4] = I_TXA;
+    c[5] = address != 0 ? I_ADC_IMM : I_ADC_ZPG;
+    c[6] = address != 0 ? address >> 8 : var_addr + 1;
+    c[7] = I_TAX;
+    c[8] = I_PLA;
+    g_c = c + 9;
+}
+
+/**
+ * Returns whether the simple operand in AX, of the given type, can be used
+ * as an index into the array without computing the element's address: a
+ * constant index into an array with a fixed address, or an index that
+ * fits in Y.
+ */
+static uint8_t is_direct_index(VarInfo *var, uint8_t index_type) {
+    uint8_t kind = get_operand_kind();
+
+    if (kind == OPERAND_CONSTANT && get_array_address(var) != 0) {
+        return 1;
+    }
+
+    if (is_small_array(var) || ELEMENT_TYPE(var->data_type) == DT_BYTE) {
+        return is_byte_operand(index_type);
+    }
+
+    return kind == OPERAND_CONSTANT && g_operand.value < 128;
+}
+
+/**
+ * Generate code to load AX from (or store AX to) an array element, given
+ * its index as a simple operand that passed is_direct_index(). For a small
+ * array (see is_small_array()), the kind can be OPERAND_NONE if the index
+ * is already in Y.
+ */
+static void compile_direct_access(VarInfo *var, uint8_t kind, uint16_t index, uint8_t store) {
+    uint8_t var_addr = get_var_address(var);
+    uint16_t address = ADDRESS(get_array_address(var));
+    uint8_t is_byte = ELEMENT_TYPE(var->data_type) == DT_BYTE;
+    uint16_t high_address = 0;
+    register uint8_t *c;
+
+    if (is_small_array(var)) {
+        // Address of the plane of high bytes.
+        high_address = address + g_array_info[var - g_variables].size;
+    } else if (!is_byte) {
+        index *= 2;
+        high_address = address + 1;
+    }
+
+    if (address != 0 && kind == OPERAND_CONSTANT) {
+        // The element's address is a constant.
+        address += index;
+        high_address += index;
+        c = g_c;
+        c[0] = store ? I_STA_ABS : I_LDA_ABS;
+        c[1] = address & 0xFF;
+        c[2] = address >> 8;
+        c += 3;
+        if (!is_byte) {
+            c[0] = store ? I_STX_ABS : I_LDX_ABS;
+            c[1] = high_address & 0xFF;
+            c[2] = high_address >> 8;
+            c += 3;
+        }
+    } else if (address != 0) {
+        // Byte index into a byte array or a small array.
+        if (kind != OPERAND_NONE) {
+            compile_load_y(kind, index);
+        }
+        c = g_c;
+        c[0] = store ? I_STA_ABS_Y : I_LDA_ABS_Y;
+        c[1] = address & 0xFF;
+        c[2] = address >> 8;
+        c += 3;
+        if (!is_byte && store) {
+            c[0] = I_TXA;
+            c[1] = I_STA_ABS_Y;
+            c[2] = high_address & 0xFF;
+            c[3] = high_address >> 8;
+            c += 4;
+        } else if (!is_byte) {
+            c[0] = I_LDX_ABS_Y;
+            c[1] = high_address & 0xFF;
+            c[2] = high_address >> 8;
+            c += 3;
+        }
+    } else if (is_byte) {
+        compile_load_y(kind, index);
+        c = g_c;
+        c[0] = store ? I_STA_IND_Y : I_LDA_IND_Y;
+        c[1] = var_addr;
+        c += 2;
+    } else if (store) {
+        compile_load_y(kind, index);
+        c = g_c;
+        c[0] = I_STA_IND_Y;
+        c[1] = var_addr;
+        c[2] = I_INY;
+        c[3] = I_TXA;
+        c[4] = I_STA_IND_Y;
+        c[5] = var_addr;
+        c += 6;
+    } else {
+        compile_load_y(kind, index + 1);
+        c = g_c;
+        c[0] = I_LDA_IND_Y;
+        c[1] = var_addr;
+        c[2] = I_TAX;
+        c[3] = I_DEY;
+        c[4] = I_LDA_IND_Y;
+        c[5] = var_addr;
+        c += 6;
+    }
+
+    if (is_byte && !store) {
+        c[0] = I_LDX_IMM;
+        c[1] = 0;
+        c += 2;
+    }
+
+    g_c = c;
+}
+
+/**
+ * Returns the power of two that a stride is, or NO_SHIFT if it's not one.
+ */
+static uint8_t get_stride_shift(uint16_t stride) {
+    uint8_t shift = 0;
+
+    while (stride > 1 && (stride & 1) == 0) {
+        stride >>= 1;
+        shift += 1;
+    }
+
+    return stride == 1 ? shift : NO_SHIFT;
+}
+
+/**
+ * Generate code to add a constant to the integer in AX. A constant operand
+ * is added at compile time.
+ */
+static void compile_add_constant(uint16_t value) {
+    register uint8_t *c;
+
+    if (get_operand_kind() == OPERAND_CONSTANT) {
+        value += g_operand.value;
+        g_c = g_operand.load;
+        compile_load_ax(value);
+        end_operand(OPERAND_CONSTANT, value);
+    } else if (value != 0) {
+        c = g_c;
+        c[0] = I_CLC;
+        c[1] = I_ADC_IMM;
+        c[2] = value & 0xFF;
+        if (value < 256) {
+            c[3] = I_BCC_REL;
+            c[4] = 1;           // Skip INX.
+            c[5] = I_INX;
+            c += 6;
+        } else {
+            c[3] = I_TAY;
+            c[4] = I_TXA;
+            c[5] = I_ADC_IMM;
+            c[6] = value >> 8;
+            c[7] = I_TAX;
+            c[8] = I_TYA;
+            c += 9;
+        }
+        g_c = c;
+    }
+}
+
+/**
+ * Generate code to multiply the integer in AX by an array's stride. A
+ * power of two is shifted in place, and a constant operand is multiplied
+ * at compile time.
+ */
+static void compile_multiply_by_stride(uint16_t stride) {
+    uint8_t shift = get_stride_shift(stride);
+    register uint8_t *c;
+
+    if (get_operand_kind() == OPERAND_CONSTANT) {
+        uint16_t value = g_operand.value*stride;
+
+        g_c = g_operand.load;
+        compile_load_ax(value);
+        end_operand(OPERAND_CONSTANT, value);
+    } else if (shift == 0) {
+        // Stride of one.
+    } else if (shift != NO_SHIFT) {
+        // Shift the high byte through tmp1.
+        c = g_c;
+        *c++ = I_STX_ZPG;
+        *c++ = ZP_ADDRESS(tmp1);
+        while (shift-- > 0) {
+            c[0] = I_ASL_A;
+            c[1] = I_ROL_ZPG;
+            c[2] = ZP_ADDRESS(tmp1);
+            c += 3;
+        }
+        c[0] = I_LDX_ZPG;
+        c[1] = ZP_ADDRESS(tmp1);
+        g_c = c + 2;
+    } else if (stride < 256) {
+        g_c[0] = I_LDY_IMM;
+        g_c[1] = stride;
+        g_c += 2;
+        add_call(mul16x8);
+    } else {
+        add_call(pushax);
+        compile_load_ax(stride);
+        add_call(mul16);
+    }
+}
+
+/**
+ * Compile the row index of a two-dimensional array element into the row
+ * offset. The index, of the given type, is in AX. A constant row offset is
+ * removed from the code and kept in the reference. Otherwise the offset is
+ * left in AX for the caller to push.
+ */
+static void compile_row_offset(ArrayRef *ref, uint8_t row_type) {
+    compile_convert(row_type, DT_INT);
+    compile_multiply_by_stride(g_array_info[ref->var - g_variables].stride);
+
+    if (get_operand_kind() == OPERAND_CONSTANT) {
+        ref->row = ROW_CONSTANT;
+        ref->row_offset = g_operand.value;
+        g_c = g_operand.load;
+    } else {
+        ref->row = ROW_PUSHED;
+    }
+}
+
+/**
+ * Generate code to add the row offset of an array element to its column
+ * index, which is in AX with the given type. A pushed row offset is popped.
+ * Returns the type of the resulting index.
+ */
+static uint8_t compile_add_row(ArrayRef *ref, uint8_t column_type) {
+    uint8_t kind;
+    uint8_t value;
+    register uint8_t *c;
+
+    if (column_type == DT_FIXED) {
+        compile_convert(column_type, DT_INT);
+        column_type = DT_INT;
+    }
+
+    if (ref->row == ROW_NONE || (ref->row == ROW_CONSTANT && ref->row_offset == 0)) {
+        return column_type;
+    }
+
+    if (ref->row == ROW_CONSTANT) {
+        compile_add_constant(ref->row_offset);
+        return DT_INT;
+    }
+
+    kind = get_operand_kind();
+    value = g_operand.value;
+    if (is_byte_operand(column_type) && unload_operand()) {
+        // Row offset is in AX. Add the byte column.
+        c = g_c;
+        c[0] = I_CLC;
+        c[1] = kind == OPERAND_CONSTANT ? I_ADC_IMM : I_ADC_ZPG;
+        c[2] = value;
+        c[3] = I_BCC_REL;
+        c[4] = 1;               // Skip INX.
+        c[5] = I_INX;
+        g_c = c + 6;
+    } else {
+        add_call(tosaddax);
+    }
+
+    return DT_INT;
+}
+
+/**
+ * In checked mode, generate code to abort the program with an error if
+ * the integer index in AX, of the given type, is out of the array's
+ * bounds. A constant index into an array allocated at compile time is
+ * checked at compile time. Preserves AX.
+ */
+static void compile_bounds_check(VarInfo *var, uint8_t index_type) {
+    ArrayInfo *a = &g_array_info[var - g_variables];
+    uint16_t limit = ADDRESS(&g_array_limits[var - g_variables]);
+    uint8_t *high_check = 0;
+    register uint8_t *c;
+
+    if (!g_check_bounds) {
+        return;
+    }
+
+    if (a->address != 0) {
+        // The number of elements is a constant.
+        if ((get_operand_kind() == OPERAND_CONSTANT && g_operand.value < a->size) ||
+                (index_type == DT_BYTE && a->size >= 256)) {
+
+            return;
+        }
+        limit = a->size;
+    }
+
+    c = g_c;
+    if (index_type != DT_BYTE || a->address == 0) {
+        // Compare high bytes, then low bytes if they're equal.
+        high_check = c;
+        if (a->address != 0) {
+            c[0] = I_CPX_IMM;
+            c[1] = limit >> 8;
+            c += 2;
+        } else {
+            c[0] = I_CPX_ABS;
+            c[1] = (limit + 1) & 0xFF;
+            c[2] = (limit + 1) >> 8;
+            c += 3;
+        }
+        c[0] = I_BCC_REL;       // In bounds, filled in below.
+        c[2] = I_BNE_REL;       // Out of bounds, filled in below.
+        c += 4;
+    }
+    if (a->address != 0) {
+        c[0] = I_CMP_IMM;
+        c[1] = limit & 0xFF;
+        c += 2;
+    } else {
+        c[0] = I_CMP_ABS;
+        c[1] = limit & 0xFF;
+        c[2] = limit >> 8;
+        c += 3;
+    }
+    c[0] = I_BCC_REL;
+    c[1] = 5;                   // Skip the JSR and line number.
+    c += 2;
+    g_c = c;
+
+    if (high_check != 0) {
+        c = high_check + (a->address != 0 ? 2 : 3);
+        c[1] = g_c + 5 - (c + 2);
+        c[3] = g_c - (c + 4);
+    }
+
+    add_call_with_line(bad_subscript_error_fast);
+}
+
+/**
+ * Generate code to load an array element into AX. The index, of the given
+ * type, is in AX.
+ */
+static void compile_array_load(VarInfo *var, uint8_t index_type) {
+    compile_convert(index_type, DT_INT);
+    compile_bounds_check(var, index_type);
+
+    if (is_direct_index(var, index_type)) {
+        uint8_t kind = g_operand.kind;
+
+        g_c = g_operand.load;
+        compile_direct_access(var, kind, g_operand.value, 0);
+    } else if (is_small_array(var)) {
+        // Only the low byte of the index is used. Like any unchecked
+        // index, one out of bounds reaches past the array, into its high
+        // byte plane or the next array.
+        *g_c++ = I_TAY;
+        compile_direct_access(var, OPERAND_NONE, 0, 0);
+    } else {
+        compile_element_address(var);
+        add_call(ELEMENT_TYPE(var->data_type) == DT_BYTE ? ldaui : ldaxi);
+    }
+}
+
+/**
+ * Generate code to raise the value in AX, of the given type, to a constant
+ * power, using one squaring per bit of the power and one multiply per extra
+ * one bit. The copies of the base that the multiplies need are pushed
+ * first. A byte is squared without going through the cc65 stack.
+ */
+static void compile_power(uint16_t power, uint8_t type) {
+    void *multiply = type == DT_FIXED ? mulfix : mul16;
+    uint16_t top;
+    uint16_t bit;
+    uint8_t first = 1;
+
+    if (power == 0) {
+        compile_load_ax(type == DT_FIXED ? 0x0100 : 1);
+        return;
+    }
+
+    top = 0x8000;
+    while ((power & top) == 0) {
+        top >>= 1;
+    }
+
+    // One copy of the base for each other one bit.
+    for (bit = top >> 1; bit != 0; bit >>= 1) {
+        if ((power & bit) != 0) {
+            add_call(pushax);
+        }
+    }
+
+    for (bit = top >> 1; bit != 0; bit >>= 1) {
+        if (first && type == DT_BYTE) {
+            g_c[0] = I_TAY;
+            g_c += 1;
+            add_call(mul16x8);
+        } else {
+            add_call(pushax);
+            add_call(multiply);
+        }
+        first = 0;
+
+        if ((power & bit) != 0) {
+            add_call(multiply);
+        }
+    }
+}
+
+/**
+ * Integer square root, rounded down.
+ */
+static uint8_t isqrt(uint16_t value) {
+    uint8_t root = 0;
+    uint8_t bit;
+
+    for (bit = 0x80; bit != 0; bit >>= 1) {
+        uint16_t trial = root | bit;
+
+        if (trial*trial <= value) {
+            root |= bit;
+        }
+    }
+
+    return root;
+}
+
+/**
+ * Generate code to apply the function ABS, SGN, SQR, PEEK, or RND to the
+ * value in AX, whose type is at the top of the type stack. The result's type
+ * replaces it. A constant argument is evaluated at compile time, or for PEEK
+ * becomes an absolute load, or for RND of a byte range an inline draw.
+ */
+static void compile_function(uint8_t op) {
+    uint8_t type = g_type_stack[g_type_stack_size - 1];
+    uint16_t value;
+    uint16_t mask;
+    uint8_t *loop;
+    uint8_t constant;
+    register uint8_t *c;
+
+    if (op == OP_SQR || op == OP_PEEK || op == OP_RND) {
+        compile_convert(type, DT_INT);
+        type = DT_INT;
+    }
+    constant = get_operand_kind() == OPERAND_CONSTANT;
+    value = g_operand.value;
+
+    switch (op) {
+        case OP_ABS:
+            // A byte is never negative. Fixed point is negated like an integer.
+            if (constant) {
+                value = (int16_t) value < 0 ? -value : value;
+            } else if (type != DT_BYTE) {
+                c = g_c;
+                c[0] = I_CPX_IMM;
+                c[1] = 0x80;
+                c[2] = I_BCC_REL;
+                c[3] = 3;               // Skip the negate.
+                g_c = c + 4;
+                add_call(negax);
+            }
+            break;
+
+        case OP_SGN:
+            if (constant) {
+                value = value == 0 ? 0 : (int16_t) value < 0 ? -1 : 1;
+                type = DT_INT;
+            } else if (type == DT_BYTE) {
+                c = g_c;
+                c[0] = I_CMP_IMM;
+                c[1] = 0;
+                c[2] = I_BEQ_REL;
+                c[3] = 2;               // Zero stays zero.
+                c[4] = I_LDA_IMM;
+                c[5] = 1;
+                g_c = c + 6;
+            } else {
+                c = g_c;
+                c[0] = I_STX_ZPG;
+                c[1] = ZP_ADDRESS(tmp1);
+                c[2] = I_ORA_ZPG;
+                c[3] = ZP_ADDRESS(tmp1);
+                c[4] = I_BEQ_REL;
+                c[5] = 11;              // Zero stays zero, with X zero too.
+                c[6] = I_CPX_IMM;
+                c[7] = 0x80;            // Carry is the sign.
+                c[8] = I_LDA_IMM;
+                c[9] = 1;
+                c[10] = I_LDX_IMM;
+                c[11] = 0;
+                c[12] = I_BCC_REL;
+                c[13] = 3;              // Positive.
+                c[14] = I_LDA_IMM;
+                c[15] = 0xFF;
+                c[16] = I_TAX;
+                g_c = c + 17;
+                type = DT_INT;
+            }
+            break;
+
+        case OP_SQR:
+            if (constant) {
+                value = isqrt(value);
+            } else {
+                add_call(sqrt16);
+            }
+            type = DT_BYTE;
+            break;
+
+        case OP_PEEK:
+            if (constant) {
+                g_c = g_operand.load;
+                c = g_c;
+                c[0] = I_LDA_ABS;
+                c[1] = value & 0xFF;
+                c[2] = value >> 8;
+                g_c = c + 3;
+                constant = 0;
+            } else {
+                compile_store_zero_page(ZP_ADDRESS(ptr1));
+                c = g_c;
+                c[0] = I_LDY_IMM;
+                c[1] = 0;
+                c[2] = I_LDA_IND_Y;
+                c[3] = ZP_ADDRESS(ptr1);
+                g_c = c + 4;
+            }
+            c = g_c;
+            c[0] = I_LDX_IMM;
+            c[1] = 0;
+            g_c = c + 2;
+            type = DT_BYTE;
+            break;
+
+        case OP_RND:
+            if (!constant || value > 256) {
+                // Variable, large, or negative range.
+                add_call(rnd16);
+                constant = 0;
+                type = DT_INT;
+                break;
+            }
+            if (value != 0) {
+                // Mask the generator to the smallest power of two covering
+                // the range, and draw again until it's in range.
+                g_c = g_operand.load;
+                loop = g_c;
+                add_call(rnd_next);
+                for (mask = 0; mask < value - 1; mask = (mask << 1) | 1) {
+                    // Nothing.
+                }
+                c = g_c;
+                if (mask != 0xFF) {
+                    c[0] = I_AND_IMM;
+                    c[1] = mask;
+                    c += 2;
+                }
+                if (mask != value - 1) {
+                    c[0] = I_CMP_IMM;
+                    c[1] = value;
+                    c[2] = I_BCS_REL;
+                    c[3] = loop - (c + 4); // Back to the JSR.
+                    c += 4;
+                }
+                c[0] = I_LDX_IMM;
+                c[1] = 0;
+                g_c = c + 2;
+                constant = 0;
+            }
+            type = DT_BYTE;
+            break;
+    }
+
+    if (constant) {
+        g_c = g_operand.load;
+        compile_load_ax(value);
+        end_operand(OPERAND_CONSTANT, value);
+    }
+    g_type_stack[g_type_stack_size - 1] = type;
+}
+
+/**
+ * Generate code for SCRN(X,Y), the color of a low-res pixel. X is on the
+ * cc65 stack and Y in AX, with their types at the top of the type stack. The
+ * result, a byte, replaces them. The row address comes from the table that
+ * PLOT uses, and is a constant if Y is.
+ */
+static void compile_scrn(void) {
+    uint8_t y_type = g_type_stack[--g_type_stack_size];
+    uint8_t kind;
+    uint16_t y;
+    uint16_t address;
+    // Zero page addresses of the Y coordinate's bytes, if it's not constant.
+    uint8_t low;
+    uint8_t high;
+    register uint8_t *c;
+
+    g_type_stack[g_type_stack_size - 1] = DT_BYTE;
+    compile_convert(y_type, DT_INT);
+    kind = get_operand_kind();
+    y = g_operand.value;
+
+    if (unload_operand()) {
+        // X coordinate is in AX, put it in Y.
+        *g_c++ = I_TAY;
+
+        if (kind == OPERAND_CONSTANT) {
+            c = g_c;
+            if (y >= GR_HEIGHT) {
+                c[0] = I_LDA_IMM;
+                c[1] = 0;
+                c += 2;
+            } else {
+                address = text_row_lo[y >> 1] | (text_row_hi[y >> 1] << 8);
+                c[0] = I_LDA_ABS_Y;
+                c[1] = address & 0xFF;
+                c[2] = address >> 8;
+                c += 3;
+                if ((y & 1) != 0) {
+                    // Odd, high nybble.
+                    c[0] = I_LSR_A;
+                    c[1] = I_LSR_A;
+                    c[2] = I_LSR_A;
+                    c[3] = I_LSR_A;
+                    c += 4;
+                } else {
+                    // Even, low nybble.
+                    c[0] = I_AND_IMM;
+                    c[1] = 0x0F;
+                    c += 2;
+                }
+            }
+            c[0] = I_LDX_IMM;
+            c[1] = 0;
+            g_c = c + 2;
+            return;
+        }
+
+        // The Y coordinate's variable. A byte variable has no high byte.
+        low = y;
+        high = y_type == DT_BYTE ? 0 : y + 1;
+    } else {
+        // Y coordinate through tmp1 and tmp2, X coordinate off the stack
+        // into Y.
+        c = g_c;
+        c[0] = I_STA_ZPG;
+        c[1] = ZP_ADDRESS(tmp1);
+        c[2] = I_STX_ZPG;
+        c[3] = ZP_ADDRESS(tmp2);
+        g_c = c + 4;
+        add_call(popax);
+        *g_c++ = I_TAY;
+        low = ZP_ADDRESS(tmp1);
+        high = ZP_ADDRESS(tmp2);
+    }
+
+    c = g_c;
+    if (high != 0) {
+        // Past row 255 (or negative), like the constant case.
+        c[0] = I_LDA_ZPG;
+        c[1] = high;
+        c[2] = I_BNE_REL;
+        c[3] = 30;                  // Skip to the zero.
+        c += 4;
+    }
+    c[0] = I_LDA_ZPG;
+    c[1] = low;
+    c[2] = I_CMP_IMM;
+    c[3] = GR_HEIGHT;
+    c[4] = I_BCS_REL;
+    c[5] = 24;                      // Off the bottom, skip to the zero.
+    c[6] = I_LSR_A;                 // Text row, with the odd/even bit in carry.
+    c[7] = I_TAX;
+    c[8] = I_LDA_ABS_X;
+    c[9] = ADDRESS(text_row_lo) & 0xFF;
+    c[10] = ADDRESS(text_row_lo) >> 8;
+    c[11] = I_STA_ZPG;
+    c[12] = ZP_ADDRESS(ptr1);
+    c[13] = I_LDA_ABS_X;
+    c[14] = ADDRESS(text_row_hi) & 0xFF;
+    c[15] = ADDRESS(text_row_hi) >> 8;
+    c[16] = I_STA_ZPG;
+    c[17] = ZP_ADDRESS(ptr1) + 1;
+    c[18] = I_LDA_IND_Y;
+    c[19] = ZP_ADDRESS(ptr1);
+    c[20] = I_BCC_REL;
+    c[21] = 4;                      // Even, skip to the mask.
+    c[22] = I_LSR_A;
+    c[23] = I_LSR_A;
+    c[24] = I_LSR_A;
+    c[25] = I_LSR_A;
+    c[26] = I_AND_IMM;
+    c[27] = 0x0F;
+    c[28] = I_BPL_REL;
+    c[29] = 2;                      // Always, skip the zero.
+    c[30] = I_LDA_IMM;
+    c[31] = 0;
+    c[32] = I_LDX_IMM;
+    c[33] = 0;
+    g_c = c + 34;
+}
+
+/**
+ * Pop an operator off the operator stack and compile it.
+ */
+static void pop_operator_stack() {
+    uint8_t op = g_op_stack[--g_op_stack_size];
+    uint8_t left_type = DT_INT;
+    uint8_t right_type = DT_INT;
+    uint8_t both_fixed = 0;
+    ArrayRef *ref;
+    VarInfo *var;
+    register uint8_t *c;
+
+    if (op != OP_NOT && op != OP_NEG && op != OP_ARRAY_DEREF && op != OP_OPEN_PARENS &&
+            !IS_FUNCTION_OP(op)) {
+
+        // Binary operator. The right operand's type is at the top of the
+        // type stack and gets replaced by the result's type.
+        uint8_t left_fixed, right_fixed;
+
+        right_type = g_type_stack[--g_type_stack_size];
+        left_type = g_type_stack[g_type_stack_size - 1];
+        left_fixed = left_type == DT_FIXED;
+        right_fixed = right_type == DT_FIXED;
+
+        if (op == OP_EXP && right_fixed) {
+            // Only integer powers.
+            compile_convert(DT_FIXED, DT_INT);
+            right_type = DT_INT;
+            right_fixed = 0;
+        }
+
+        if (left_fixed != right_fixed && op != OP_AND && op != OP_OR && op != OP_MULT &&
+                ((op != OP_DIV && op != OP_EXP) || !left_fixed)) {
+
+            // Mixed integer (or byte) and fixed point, convert the integer
+            // operand. Logical operators only care about zero, and fixed point
+            // multiplied, divided, or raised to an integer power is already
+            // fixed point.
+            if (!left_fixed) {
+                compile_convert_left_to_fixed();
+                left_fixed = 1;
+            } else {
+                compile_convert(right_type, DT_FIXED);
+                right_fixed = 1;
+            }
+        }
+
+        both_fixed = left_fixed && right_fixed;
+
+        // Logical and comparison operators give integers. Arithmetic on
+        // bytes widens to integers.
+        g_type_stack[g_type_stack_size - 1] =
+            (left_fixed || right_fixed) && OP_PRECEDENCE(op) > OP_PRECEDENCE(OP_GT) ?
+            DT_FIXED : DT_INT;
+    }
+
+    switch (op) {
+        case OP_ADD:
+            add_call(tosaddax);
+            break;
+
+        case OP_SUB:
+            add_call(tossubax);
+            break;
+
+        case OP_MULT:
+            if (both_fixed) {
+                add_call(mulfix);
+            } else if (get_operand_kind() == OPERAND_CONSTANT && g_operand.value < 256 &&
+                    unload_operand()) {
+
+                // Left operand is in AX. Multiply by the constant in Y.
+                c = g_c;
+                c[0] = I_LDY_IMM;
+                c[1] = g_operand.value;
+                g_c = c + 2;
+                add_call(mul16x8);
+            } else {
+                add_call(mul16);
+            }
+            break;
+
+        case OP_DIV:
+            add_call(both_fixed ? (void *) div_fixed : (void *) div16);
+            break;
+
+        case OP_MOD:
+            // Fixed point has the same remainder as its raw value.
+            if (left_type == DT_BYTE && !both_fixed &&
+                    get_operand_kind() == OPERAND_CONSTANT && g_operand.value != 0 &&
+                    (g_operand.value & (g_operand.value - 1)) == 0 && unload_operand()) {
+
+                // A byte is never negative, so a power of two is a mask.
+                if (g_operand.value < 256) {
+                    c = g_c;
+                    c[0] = I_AND_IMM;
+                    c[1] = g_operand.value - 1;
+                    g_c = c + 2;
+                }
+                g_type_stack[g_type_stack_size - 1] = DT_BYTE;
+            } else {
+                add_call(mod16);
+            }
+            break;
+
+        case OP_EXP:
+            if (get_operand_kind() == OPERAND_CONSTANT &&
+                    g_operand.value <= MAX_UNROLLED_POWER && unload_operand()) {
+
+                // Base is in AX.
+                compile_power(g_operand.value, left_type);
+            } else {
+                add_call(left_type == DT_FIXED ? powfix : pow16);
+            }
+            break;
+
+        case OP_EQ:
+            compile_compare(op, left_type, right_type, toseqax);
+            break;
+
+        case OP_NEQ:
+            compile_compare(op, left_type, right_type, tosneax);
+            break;
+
+        case OP_LT:
+            compile_compare(op, left_type, right_type, tosltax);
+            break;
+
+        case OP_GT:
+            compile_compare(op, left_type, right_type, tosgtax);
+            break;
+
+        case OP_LTE:
+            compile_compare(op, left_type, right_type, tosleax);
+            break;
+
+        case OP_GTE:
+            compile_compare(op, left_type, right_type, tosgeax);
+            break;
+
+        case OP_AND:
+            // AppleSoft BASIC does not have short-circuit logical operators.
+
+            // See if second operand is 0.
+            c = g_c;
+            c[0] = I_STX_ZPG;
+            c[1] = ZP_ADDRESS(tmp1);
+            c[2] = I_ORA_ZPG;
+            c[3] = ZP_ADDRESS(tmp1);
+            c[4] = I_PHP;               // Save the zero bit.
+            g_c = c + 5;
+            add_call(popax);            // Pop first parameters. 3 instructions.
+            c = g_c;
+            c[0] = I_PLP;               // Restore zero bit from second operand.
+            c[1] = I_BNE_REL;           // Check whether second operand was zero.
+            c[2] = 4;                   // Not zero, continue to first parameter.
+            c[3] = I_LDA_IMM;
+            c[4] = 0;
+            c[5] = I_BEQ_REL;           // Zero bit always true here, will always jump.
+            c[6] = 8;                   // Set X to zero and exit.
+            // See if first operand (we just popped) is 0.
+            c[7] = I_STX_ZPG;
+            c[8] = ZP_ADDRESS(tmp1);
+            c[9] = I_ORA_ZPG;
+            c[10] = ZP_ADDRESS(tmp1);
+            // If so, skip setting A to 1. A contains 0.
+            c[11] = I_BEQ_REL;
+            c[12] = 2; // The LDA below.
+            // Set A to 1.
+            c[13] = I_LDA_IMM;
+            c[14] = 1;
+            c[15] = I_LDX_IMM;          // The BEQs above arrive here.
+            c[16] = 0;
+            g_c = c + 17;
+            break;
+
+        case OP_OR:
+            // AppleSoft BASIC does not have short-circuit logical operators.
+
+            // See if second operand is 0.
+            c = g_c;
+            c[0] = I_STX_ZPG;
+            c[1] = ZP_ADDRESS(tmp1);
+            c[2] = I_ORA_ZPG;
+            c[3] = ZP_ADDRESS(tmp1);
+            c[4] = I_STA_ZPG;
+            c[5] = ZP_ADDRESS(tmp2);     // Store OR of bytes in tmp2 for later.
+            g_c = c + 6;
+            add_call(popax);            // Pop first parameters. 3 instructions.
+            c = g_c;
+            // See if first operand is 0.
+            c[0] = I_STX_ZPG;
+            c[1] = ZP_ADDRESS(tmp1);
+            c[2] = I_ORA_ZPG;
+            c[3] = ZP_ADDRESS(tmp1);
+            c[4] = I_ORA_ZPG;
+            c[5] = ZP_ADDRESS(tmp2);     // OR with other parameter.
+            // If so, skip setting A to 1. A contains 0.
+            c[6] = I_BEQ_REL;
+            c[7] = 2; // The LDA below.
+            // Set A to 1.
+            c[8] = I_LDA_IMM;
+            c[9] = 1;
+            c[10] = I_LDX_IMM;     // The BEQs above arrive here.
+            c[11] = 0;
+            g_c = c + 12;
+            break;
+
+        case OP_NOT:
+            add_call(bnegax);
+            g_type_stack[g_type_stack_size - 1] = DT_INT;
+            break;
+
+        case OP_NEG:
+            add_call(negax);
+            break;
+
+        case OP_ARRAY_DEREF:
+            // Index is in AX. The array's address is still in its variable.
+            // The element replaces the index on the type stack, and the
+            // column index of a two-dimensional array is added to its row
+            // offset.
+            ref = &g_array_stack[--g_array_stack_size];
+            var = ref->var;
+            right_type = g_type_stack[g_type_stack_size - 1];
+            if (ref->row == ROW_PUSHED) {
+                g_type_stack_size -= 1;
+            }
+            compile_array_load(var, compile_add_row(ref, right_type));
+            g_type_stack[g_type_stack_size - 1] = ELEMENT_TYPE(var->data_type);
+            break;
+
+        case OP_OPEN_PARENS:
+            // No-op.
+            break;
+
+        case OP_ABS:
+        case OP_SGN:
+        case OP_SQR:
+        case OP_PEEK:
+        case OP_RND:
+            compile_function(op);
+            break;
+
+        case OP_SCRN:
+            // Missing Y coordinate, a syntax error. Keep the stacks in
+            // order until the statement reports it.
+            compile_load_ax(0);
+            g_type_stack[g_type_stack_size - 1] = DT_BYTE;
+            break;
+
+        case OP_SCRN_XY:
+            compile_scrn();
+            break;
+
+        default:
+            print((uint8_t *) "Unhandled operator\n");
+            break;
+    }
+}
+
+/**
+ * Push an operator onto the operator stack. Follow the Shunting-yard
+ * algorithm so that higher-precedence operators are performed
+ * first.
+ *
+ * https://en.wikipedia.org/wiki/Shunting-yard_algorithm
+ * http://wcipeg.com/wiki/Shunting_yard_algorithm
+ */
+static void push_operator_stack(uint8_t op) {
+    uint8_t top_op;
+
+    // Don't pop anything off if op is unary.
+    if (op != OP_NOT && op != OP_NEG && !IS_FUNCTION_OP(op)) {
+        // All our operators are left-associative, so no special check for the case
+        // of equal precedence.
+        while (g_op_stack_size > 0 &&
+                op != OP_OPEN_PARENS &&
+                op != OP_ARRAY_DEREF &&
+                (top_op = g_op_stack[g_op_stack_size - 1]) != OP_OPEN_PARENS &&
+                top_op != OP_ARRAY_DEREF &&
+                OP_PRECEDENCE(top_op) >= OP_PRECEDENCE(op)) {
+
+            pop_operator_stack();
+        }
+    }
+
+    // TODO Check for g_op_stack overflow.
+    g_op_stack[g_op_stack_size++] = op;
+}
+
+/**
+ * Generate code to load AX with the key that's waiting, without its high
+ * bit, and clear it. If nothing is waiting, either loads 0 or waits for a
+ * key.
+ */
+static void compile_key(uint8_t wait) {
+    register uint8_t *c = g_c;
+
+    if (wait) {
+        c[0] = I_LDA_ABS;
+        c[1] = KBD_KEY & 0xFF;
+        c[2] = KBD_KEY >> 8;
+        c[3] = I_BPL_REL;
+        c[4] = -5;                  // Back to the load.
+        c[5] = I_BIT_ABS;
+        c[6] = KBD_STROBE & 0xFF;
+        c[7] = KBD_STROBE >> 8;
+        c[8] = I_AND_IMM;
+        c[9] = 0x7F;
+        c[10] = I_LDX_IMM;
+        c[11] = 0;
+        g_c = c + 12;
+    } else {
+        c[0] = I_LDX_IMM;
+        c[1] = 0;
+        c[2] = I_LDA_ABS;
+        c[3] = KBD_KEY & 0xFF;
+        c[4] = KBD_KEY >> 8;
+        c[5] = I_BMI_REL;
+        c[6] = 3;                   // Skip to the strobe.
+        c[7] = I_TXA;
+        c[8] = I_BPL_REL;
+        c[9] = 5;                   // Always, skip the strobe.
+        c[10] = I_BIT_ABS;
+        c[11] = KBD_STROBE & 0xFF;
+        c[12] = KBD_STROBE >> 8;
+        c[13] = I_AND_IMM;
+        c[14] = 0x7F;
+        g_c = c + 15;
+    }
+}
+
+/**
+ * Returns the operator of the function whose token is given, or OP_INVALID
+ * if it's not a function.
+ */
+static uint8_t get_function_op(uint8_t token) {
+    switch (token) {
+        case T_ABS:
+            return OP_ABS;
+        case T_SGN:
+            return OP_SGN;
+        case T_SQR:
+            return OP_SQR;
+        case T_PEEK:
+            return OP_PEEK;
+        case T_SCRN:
+            return OP_SCRN;
+        case T_RND:
+            return OP_RND;
+        default:
+            return OP_INVALID;
+    }
+}
+
+/**
+ * Parse an expression, generating code to compute it, leaving the
+ * result in AX.
+ */
+static uint8_t *compile_expression(uint8_t *s) {
+    char have_value_in_ax = 0;
+    uint8_t expect_unary = 1; // Expect unary operator at start of expression.
+
+    g_operand.kind = OPERAND_NONE;
+    g_type_stack_size = 0;
+
+    while (1) {
+        if (IS_DIGIT(*s)) {
+            // Parse number.
+            uint16_t value = parse_uint16(&s);
+            uint8_t type = DT_INT;
+
+            if (*s == '.') {
+                // Fixed-point literal.
+                s += 1;
+                value = (value << 8) + parse_fraction(&s);
+                type = DT_FIXED;
+            }
+
+            begin_operand(have_value_in_ax);
+            compile_load_ax(value);
+            end_operand(OPERAND_CONSTANT, value);
+            push_type(type);
+            have_value_in_ax = 1;
+
+            // Expect binary operator after operand.
+            expect_unary = 0;
+        } else if (IS_FIRST_VARIABLE_LETTER(*s)) {
+            // Variable reference.
+            VarInfo *var = find_variable(&s);
+
+            begin_operand(have_value_in_ax);
+
+            if (var != 0 && IS_ARRAY(var->data_type)) {
+                // In checked mode, an array that hasn't been DIM'ed has no
+                // elements, so any index fails the bounds check.
+
+                // The array's address stays in its variable. Treat the open
+                // parenthesis (which find_variable() requires for an array)
+                // as an array-dereferencing operator, which loads the element
+                // once the index is in AX.
+                s += 1;
+                g_array_stack[g_array_stack_size].var = var;
+                g_array_stack[g_array_stack_size].row = ROW_NONE;
+                g_array_stack_size += 1;
+                push_operator_stack(OP_ARRAY_DEREF);
+                have_value_in_ax = 0;
+                expect_unary = 1;
+            } else {
+                if (var == 0) {
+                    // TODO: Not sure how to deal with this. For now just
+                    // fill in with zero, since assigning to this elsewhere
+                    // will cause an error.
+                    compile_load_ax(0);
+                    push_type(DT_INT);
+                } else {
+                    uint8_t var_addr = get_var_address(var);
+                    uint8_t var_type = get_var_type(var);
+
+                    // Load from var.
+                    compile_load_variable(var_addr, var_type);
+                    end_operand(OPERAND_VARIABLE, var_addr);
+                    push_type(var_type);
+                }
+                have_value_in_ax = 1;
+
+                // Expect binary operator after operand.
+                expect_unary = 0;
+            }
+        } else if (*s == T_KEY) {
+            // Key that's waiting, or 0.
+            s += 1;
+            begin_operand(have_value_in_ax);
+            compile_key(0);
+            push_type(DT_BYTE);
+            have_value_in_ax = 1;
+
+            // Expect binary operator after operand.
+            expect_unary = 0;
+        } else {
+            // Check if it's an operator.
+            uint8_t op = OP_INVALID;
+
+            if (*s == T_PLUS) {
+                op = expect_unary ? OP_NO_OP : OP_ADD;
+            } else if (*s == T_MINUS) {
+                op = expect_unary ? OP_NEG : OP_SUB;
+            } else if (*s == T_ASTERISK) {
+                op = OP_MULT;
+            } else if (*s == T_SLASH) {
+                op = OP_DIV;
+            } else if (*s == T_CARET) {
+                op = OP_EXP;
+            } else if (*s == T_MOD) {
+                op = OP_MOD;
+            } else if (s[1] == '(' && (op = get_function_op(*s)) != OP_INVALID) {
+                // The open parenthesis is pushed next, and the function is
+                // applied when it's closed.
+            } else if (*s == T_AND) {
+                op = OP_AND;
+            } else if (*s == T_OR) {
+                op = OP_OR;
+            } else if (*s == T_NOT) {
+                if (expect_unary) {
+                    op = OP_NOT;
+                } else {
+                    // TODO generate syntax error.
+                    break;
+                }
+            } else if (*s == T_EQUAL) {
+                if (s[1] == T_LESS_THAN) {
+                    s += 1;
+                    op = OP_LTE;
+                } else if (s[1] == T_GREATER_THAN) {
+                    s += 1;
+                    op = OP_GTE;
+                } else {
+                    op = OP_EQ;
+                }
+            } else if (*s == T_LESS_THAN) {
+                if (s[1] == T_EQUAL) {
+                    s += 1;
+                    op = OP_LTE;
+                } else if (s[1] == T_GREATER_THAN) {
+                    s += 1;
+                    op = OP_NEQ;
+                } else {
+                    op = OP_LT;
+                }
+            } else if (*s == T_GREATER_THAN) {
+                if (s[1] == T_EQUAL) {
+                    s += 1;
+                    op = OP_GTE;
+                } else if (s[1] == T_LESS_THAN) {
+                    s += 1;
+                    op = OP_NEQ;
+                } else {
+                    op = OP_GT;
+                }
+            } else if (*s == ',' && have_value_in_ax) {
+                uint8_t top_op = OP_INVALID;
+                ArrayRef *ref;
+
+                // Pop until open parenthesis or array dereference.
+                while (g_op_stack_size > 0 &&
+                       (top_op = g_op_stack[g_op_stack_size - 1]) != OP_OPEN_PARENS &&
+                       top_op != OP_ARRAY_DEREF) {
+
+                    pop_operator_stack();
+                }
+
+                // Separates the row and column of a two-dimensional array.
+                // Otherwise it's not ours, like in "PLOT X,Y", and it ends
+                // the expression.
+                ref = top_op == OP_ARRAY_DEREF ? &g_array_stack[g_array_stack_size - 1] : 0;
+                if (ref != 0 && ref->row == ROW_NONE &&
+                        g_array_info[ref->var - g_variables].columns != 0) {
+
+                    compile_row_offset(ref, g_type_stack[g_type_stack_size - 1]);
+                    if (ref->row == ROW_CONSTANT) {
+                        g_type_stack_size -= 1;
+                        have_value_in_ax = 0;
+                    } else {
+                        // Pushed by the column's first operand.
+                        g_type_stack[g_type_stack_size - 1] = DT_INT;
+                    }
+                    op = OP_NO_OP;
+                } else if (top_op == OP_OPEN_PARENS && g_op_stack_size > 1 &&
+                        g_op_stack[g_op_stack_size - 2] == OP_SCRN) {
+
+                    // Separates the X and Y coordinates of SCRN. X is pushed
+                    // by the Y coordinate's first operand.
+                    compile_convert(g_type_stack[g_type_stack_size - 1], DT_INT);
+                    g_type_stack[g_type_stack_size - 1] = DT_INT;
+                    g_op_stack[g_op_stack_size - 2] = OP_SCRN_XY;
+                    op = OP_NO_OP;
+                }
+            } else if (*s == '(') { // Parentheses are not tokenized.
+                op = OP_OPEN_PARENS;
+            } else if (*s == ')') { // Parentheses are not tokenized.
+                uint8_t top_op;
+
+                op = OP_CLOSE_PARENS;
+
+                // Pop until open parenthesis or array dereference.
+                while (g_op_stack_size > 0 &&
+                       (top_op = g_op_stack[g_op_stack_size - 1]) != OP_OPEN_PARENS &&
+                       top_op != OP_ARRAY_DEREF) {
+
+                    pop_operator_stack();
+                }
+                if (g_op_stack_size == 0) {
+                    // Maybe this close parenthesis wasn't ours. For example,
+                    // "DIM X(5)". Treat it like end of expression.
+                    op = OP_INVALID;
+                } else if (top_op == OP_OPEN_PARENS && g_op_stack_size > 1 &&
+                        g_op_stack[g_op_stack_size - 2] == OP_SCRN) {
+
+                    // SCRN without a Y coordinate. End the expression here,
+                    // so that the statement reports the close parenthesis
+                    // as a syntax error.
+                    g_op_stack_size -= 1;
+                    op = OP_INVALID;
+                } else {
+                    // Pop open parenthesis or array dereference.
+                    pop_operator_stack();
+
+                    // Apply the function whose argument this was, if any.
+                    if (top_op == OP_OPEN_PARENS && g_op_stack_size > 0 &&
+                            IS_FUNCTION_OP(g_op_stack[g_op_stack_size - 1])) {
+
+                        pop_operator_stack();
+                    }
+                }
+            }
+
+            // Check that we didn't have an inappropriate unary operator.
+            if (expect_unary && op != OP_NO_OP && op != OP_NEG && op != OP_NOT &&
+                    op != OP_OPEN_PARENS && op != OP_ARRAY_DEREF && !IS_FUNCTION_OP(op)) {
+
+                // TODO we should generate a syntax error here.
+                print((uint8_t *) "Unexpected unary\n");
+                break;
+            }
+
+            // Expect unary operator after operators or open parenthesis. Expect
+            // binary operator after close parenthesis.
+            expect_unary = op != OP_CLOSE_PARENS;
+
+            if (op != OP_INVALID) {
+                s += 1;
+                if (op != OP_CLOSE_PARENS && op != OP_NO_OP) {
+                    push_operator_stack(op);
+                }
+            } else {
+                break;
+            }
+        }
+    }
+
+    if (have_value_in_ax) {
+        // Empty the operator stack.
+        while (g_op_stack_size > 0) {
+            if (g_op_stack[g_op_stack_size - 1] == OP_OPEN_PARENS) {
+                // TODO we should generate a syntax error here.
+                print((uint8_t *) "Extra open parenthesis\n");
+            }
+            pop_operator_stack();
+        }
+        g_expression_type = g_type_stack[0];
+    } else {
+        // Something went wrong, we never got anything.
+        print((uint8_t *) "Expression has no content\n");
+        compile_load_ax(0);
+        g_expression_type = DT_INT;
+    }
+
+    return s;
+}
+
+/**
+ * Parse an expression, generating code to compute it as an integer,
+ * leaving the result in AX.
+ */
+static uint8_t *compile_int_expression(uint8_t *s) {
+    s = compile_expression(s);
+    compile_convert(g_expression_type, DT_INT);
+
+    return s;
+}
+
+/**
+ * Compile "X = X + 1" or "X = X - 1" as an increment or decrement of the
+ * variable in place. The pointer is just past the equal sign. Returns the
+ * pointer past the expression, or 0 if the expression isn't one of those.
+ */
+static uint8_t *compile_increment(uint8_t var_addr, uint8_t data_type, uint8_t *s) {
+    VarInfo *var;
+    uint8_t op;
+    register uint8_t *c;
+
+    if (!IS_FIRST_VARIABLE_LETTER(*s)) {
+        return 0;
+    }
+    var = find_variable(&s);
+    if (var == 0 || get_var_address(var) != var_addr) {
+        return 0;
+    }
+
+    op = s[0];
+    if ((op != T_PLUS && op != T_MINUS) || s[1] != '1' || (s[2] != '\0' && s[2] != ':')) {
+        return 0;
+    }
+
+    c = g_c;
+    if (data_type == DT_BYTE) {
+        c[0] = op == T_PLUS ? I_INC_ZPG : I_DEC_ZPG;
+        c[1] = var_addr;
+        c += 2;
+    } else if (data_type == DT_FIXED) {
+        // One is the low byte of the integer part.
+        c[0] = op == T_PLUS ? I_INC_ZPG : I_DEC_ZPG;
+        c[1] = var_addr + 1;
+        c += 2;
+    } else if (op == T_PLUS) {
+        c[0] = I_INC_ZPG;
+        c[1] = var_addr;
+        c[2] = I_BNE_REL;
+        c[3] = 2;               // Skip high byte.
+        c[4] = I_INC_ZPG;
+        c[5] = var_addr + 1;
+        c += 6;
+    } else {
+        c[0] = I_LDA_ZPG;
+        c[1] = var_addr;
+        c[2] = I_BNE_REL;
+        c[3] = 2;               // Skip high byte.
+        c[4] = I_DEC_ZPG;
+        c[5] = var_addr + 1;
+        c[6] = I_DEC_ZPG;
+        c[7] = var_addr;
+        c += 8;
+    }
+    g_c = c;
+
+    return s + 2;
+}
+
+/**
+ * Tokenize a string in place. Returns (and removes) any line number, or
+ * INVALID_LINE_NUMBER if there's none.
+ */
+uint16_t tokenize(uint8_t *s) {
+    uint8_t *t = s; // Tokenized version.
+    int16_t line_number;
+
+    // Parse optional line number.
+    if (IS_DIGIT(*s)) {
+        line_number = parse_uint16(&s);
+    } else {
+        line_number = INVALID_LINE_NUMBER;
+    }
+
+    // Convert tokens.
+    while (*s != '\0') {
+        if (*s == ' ') {
+            // Skip spaces.
+            s++;
+        } else {
+            int16_t i;
+            uint8_t *skipped = 0;
+
+            // Try every token.
+            for (i = 0; i < TOKEN_COUNT; i++) {
+                // Quick optimization, peek at the first letter.
+                skipped = s[0] == TOKEN[i][0] ? skip_over(s, (uint8_t *) TOKEN[i]) : 0;
+                if (skipped != 0) {
+                    // Record token.
+                    *t++ = 0x80 + i;
+                    s = skipped;
+                    break;
+                }
+            }
+
+            if (skipped == 0) {
+                // Didn't find a token, just copy text.
+                *t++ = *s++;
+            }
+        }
+    }
+
+    // Terminate string.
+    *t++ = '\0';
+
+    return line_number;
+}
+
+/**
+ * Find the stored program line with the given line number. If the line does
+ * not exist, returns a pointer to the location where it should be inserted.
+ */
+static uint8_t *find_line(uint16_t line_number) {
+    uint8_t *line = g_program;
+    uint8_t *next_line;
+
+    while ((next_line = get_next_line(line)) != 0) {
+        // See if we hit it or just blew past it.
+        if (get_line_number(line) >= line_number) {
+            break;
+        }
+
+        line = next_line;
+    }
+
+    return line;
+}
+
+/**
+ * Adds a new entry to the list for forward GOTOs. Returns whether successful.
+ */
+static uint8_t add_forward_goto(uint16_t source_line_number, uint16_t target_line_number,
+        uint8_t *address_low, uint8_t *address_high) {
+
+    ForwardGoto *f;
+
+    if (g_forward_goto_count == MAX_FORWARD_GOTO) {
+        return 0;
+    }
+
+    f = &g_forward_goto[g_forward_goto_count++];
+    f->source_line_number = source_line_number;
+    f->target_line_number = target_line_number;
+    f->address_low = address_low;
+    f->address_high = address_high;
+
+    return 1;
+}
+
+/**
+ * Go through the list of forward GOTOs and set their jumps to this code.
+ */
+static void fix_up_forward_gotos(uint16_t line_number, uint8_t *code) {
+    int i;
+    ForwardGoto *f;
+    uint16_t addr = ADDRESS(code);
+
+    for (i = 0; i < g_forward_goto_count; i++) {
+        f = &g_forward_goto[i];
+
+        if (f->target_line_number == line_number) {
+            // Fill in jump address.
+            *f->address_low = addr & 0xFF;
+            *f->address_high = addr >> 8;
+
+            // Swap last entry with this one. It's okay if these
+            // are the same entry.
+            *f = g_forward_goto[g_forward_goto_count - 1];
+
+            // Reduce size of array.
+            g_forward_goto_count -= 1;
+
+            // Re-process this entry, since we've swapped it.
+            i -= 1;
+        }
+    }
+}
+
+/**
+ * Add a JMP or JSR (the opcode) to the code of the target line. A line that
+ * hasn't been compiled yet is recorded as a forward GOTO and filled in later.
+ * Returns whether successful.
+ */
+static uint8_t compile_jump_to_line(uint8_t opcode, uint16_t source_line_number,
+        uint16_t target_line_number) {
+
+    uint8_t *c = g_c;
+    uint16_t addr = ADDRESS(find_line_address(target_line_number));
+
+    if (addr == 0) {
+        // Line not found. Must be a forward reference. Record it
+        // and keep going.
+        if (!add_forward_goto(source_line_number, target_line_number, c + 1, c + 2)) {
+            return 0;
+        }
+    }
+
+    c[0] = opcode;
+    c[1] = addr & 0xFF;
+    c[2] = addr >> 8;
+    g_c = c + 3;
+
+    return 1;
+}
+
+/**
+ * Generate the check before a GOSUB that there's room on the hardware stack
+ * for the return address and whatever the subroutine calls. Leaves Y alone.
+ */
+static void compile_gosub_guard(void) {
+    uint8_t *c = g_c;
+
+    c[0] = I_TSX;
+    c[1] = I_CPX_IMM;
+    c[2] = MIN_GOSUB_STACK;
+    c[3] = I_BCS_REL;
+    c[4] = 5;               // Skip error call and line number.
+    g_c = c + 5;
+    add_call_with_line(out_of_memory_error_fast);
+}
+
+/**
+ * Generate the check before a RETURN or POP that the program is inside a
+ * GOSUB, whose return address puts the hardware stack pointer below the
+ * top level's.
+ */
+static void compile_return_guard(void) {
+    uint8_t *c = g_c;
+
+    c[0] = I_TSX;
+    c[1] = I_CPX_ABS;
+    c[2] = ADDRESS(&program_stack) & 0xFF;
+    c[3] = ADDRESS(&program_stack) >> 8;
+    c[4] = I_BCC_REL;
+    c[5] = 5;               // Skip error call and line number.
+    g_c = c + 6;
+    add_call_with_line(return_without_gosub_error_fast);
+}
+
+/**
+ * Compile "ON expr GOTO" or "ON expr GOSUB" followed by a list of line
+ * numbers. The pointer is just past the ON. An index of 1 picks the first
+ * line, and an index out of range goes on to the next statement. The line
+ * addresses are in low and high byte tables after the code, filled in
+ * like forward GOTOs when needed. Returns the pointer past the list, or 0
+ * on a syntax error.
+ */
+static uint8_t *compile_on(uint8_t *s, uint16_t line_number) {
+    uint8_t *c;
+    uint8_t *t;
+    uint8_t *fail;
+    uint8_t *out;
+    uint8_t *table;
+    uint8_t gosub;
+    uint8_t count;
+    uint8_t i;
+
+    s = compile_expression(s);
+
+    if (*s == T_GOTO) {
+        gosub = 0;
+    } else if (*s == T_GOSUB) {
+        gosub = 1;
+    } else {
+        return 0;
+    }
+    s += 1;
+
+    // Count the line numbers.
+    count = 0;
+    t = s;
+    while (1) {
+        if (!IS_DIGIT(*t) || count == MAX_ON_TARGETS) {
+            return 0;
+        }
+        parse_uint16(&t);
+        count += 1;
+        if (*t != ',') {
+            break;
+        }
+        t += 1;
+    }
+
+    // Index in Y. A byte is already in range for the high byte.
+    c = g_c;
+    if (g_expression_type != DT_BYTE) {
+        compile_convert(g_expression_type, DT_INT);
+        c = g_c;
+        c[0] = I_CPX_IMM;
+        c[1] = 0;
+        c[2] = I_BNE_REL;
+        c[3] = 7;                   // To the JMP below.
+        c += 4;
+    }
+    c[0] = I_TAY;
+    c[1] = I_BEQ_REL;
+    c[2] = 4;                       // To the JMP below.
+    c[3] = I_CPY_IMM;
+    c[4] = count + 1;
+    c[5] = I_BCC_REL;
+    c[6] = 3;                       // Skip the JMP.
+    c[7] = I_JMP_ABS;               // Out of range, to the next statement.
+    fail = c + 8;                   // Filled in below.
+    g_c = c + 10;
+
+    if (gosub) {
+        // Call the dispatch below, then go on to the next statement.
+        compile_gosub_guard();
+        c = g_c;
+        c[0] = I_JSR;
+        c[1] = ADDRESS(c + 6) & 0xFF;
+        c[2] = ADDRESS(c + 6) >> 8;
+        c[3] = I_JMP_ABS;
+        out = c + 4;                // Filled in below.
+        g_c = c + 6;
+    } else {
+        out = 0;
+    }
+
+    // Jump through the tables. Indexes start at 1.
+    table = g_c + 13;
+    c = g_c;
+    c[0] = I_LDA_ABS_Y;
+    c[1] = ADDRESS(table - 1) & 0xFF;
+    c[2] = ADDRESS(table - 1) >> 8;
+    c[3] = I_STA_ZPG;
+    c[4] = ZP_ADDRESS(ptr1);
+    c[5] = I_LDA_ABS_Y;
+    c[6] = ADDRESS(table + count - 1) & 0xFF;
+    c[7] = ADDRESS(table + count - 1) >> 8;
+    c[8] = I_STA_ZPG;
+    c[9] = ZP_ADDRESS(ptr1) + 1;
+    c[10] = I_JMP_IND;
+    c[11] = ZP_ADDRESS(ptr1);
+    c[12] = 0;
+
+    // Low bytes, then high bytes.
+    g_c = table + count*2;
+    for (i = 0; i < count; i++) {
+        uint16_t target_line_number = parse_uint16(&s);
+        uint16_t addr = ADDRESS(find_line_address(target_line_number));
+
+        if (addr == 0 && !add_forward_goto(line_number, target_line_number,
+                    &table[i], &table[count + i])) {
+
+            return 0;
+        }
+        table[i] = addr & 0xFF;
+        table[count + i] = addr >> 8;
+
+        if (*s == ',') {
+            s += 1;
+        }
+    }
+
+    // Where we go when done.
+    fail[0] = ADDRESS(g_c) & 0xFF;
+    fail[1] = ADDRESS(g_c) >> 8;
+    if (out != 0) {
+        out[0] = fail[0];
+        out[1] = fail[1];
+    }
+
+    return s;
+}
+
+/**
+ * Adds an entry to the list of line infos. Returns whether successful.
+ */
+static uint8_t add_line_info(uint16_t line_number, uint8_t *code) {
+    LineInfo *l;
+
+    if (g_line_info_count == MAX_LINES) {
+        // TODO not sure what to do here.
+        print((uint8_t *) "Program too large");
+        return 0;
+    }
+
+    l = &g_line_info[g_line_info_count++];
+    l->line_number = line_number;
+    l->code = code;
+
+    // Fix up any forward GOTOs to this line.
+    fix_up_forward_gotos(line_number, code);
+
+    return 1;
+}
+
+/**
+ * Skip to the next comma or close parenthesis that's not inside
+ * parentheses, or to the end of the statement.
+ */
+static uint8_t *skip_to_separator(uint8_t *s) {
+    uint8_t depth = 0;
+
+    while (!IS_END_OF_STATEMENT(*s) && (depth > 0 || (*s != ',' && *s != ')'))) {
+        if (*s == '(') {
+            depth += 1;
+        } else if (*s == ')') {
+            depth -= 1;
+        }
+        s += 1;
+    }
+
+    return s;
+}
+
+/**
+ * Parse a token followed by an integer constant, with an optional minus
+ * sign. Returns whether successful, in which case the pointer is moved past
+ * the constant.
+ */
+static uint8_t parse_token_constant(uint8_t **s_ptr, uint8_t token, int16_t *value) {
+    uint8_t *s = *s_ptr;
+    uint8_t negative;
+
+    if (*s != token) {
+        return 0;
+    }
+    s += 1;
+
+    negative = *s == T_MINUS;
+    if (negative) {
+        s += 1;
+    }
+    if (!IS_DIGIT(*s)) {
+        return 0;
+    }
+    *value = parse_uint16(&s);
+    if (*s == '.') {
+        return 0;
+    }
+    if (negative) {
+        *value = -*value;
+    }
+
+    *s_ptr = s;
+
+    return 1;
+}
+
+/**
+ * Parse a variable name for range analysis. Returns the index of the
+ * variable in g_variables if it's an integer scalar, or NO_INDEX.
+ */
+static uint8_t parse_range_variable(uint8_t **s_ptr) {
+    VarInfo *var;
+
+    if (!IS_FIRST_VARIABLE_LETTER(**s_ptr)) {
+        return NO_INDEX;
+    }
+
+    var = find_variable(s_ptr);
+
+    return var != 0 && var->data_type == DT_INT ? var - g_variables : NO_INDEX;
+}
+
+/**
+ * Widen the range of a variable to include a value.
+ */
+static void add_to_range(uint8_t var, int16_t value) {
+    Range *r = &g_range[var];
+
+    if (value < 0 || value > 255) {
+        r->unbounded = 1;
+    } else if (value < r->low) {
+        r->low = value;
+    } else if (value > r->high) {
+        r->high = value;
+    }
+}
+
+/**
+ * Find the values assigned to integer variables in a tokenized line of the
+ * stored program. Constants and FOR loops with constant bounds widen the
+ * variable's range, increments and decrements are recorded in g_increment,
+ * and anything else makes the variable unbounded. The pending parameter is
+ * the increment (or NO_INDEX) in the statement just before the line, which
+ * an IF at the start of the line can guard. Returns the pending increment
+ * at the end of the line.
+ */
+static uint8_t analyze_line(uint8_t *s, uint8_t pending) {
+    // The variable, comparison token, and constant of an IF whose THEN
+    // clause is the next statement.
+    uint8_t if_var = NO_INDEX;
+    uint8_t if_op = 0;
+    int16_t if_value = 0;
+
+    while (*s != '\0') {
+        uint8_t previous = pending;
+        uint8_t guard_var = if_var;
+        uint8_t var;
+        uint8_t or_equal;
+        int16_t value;
+
+        pending = NO_INDEX;
+        if_var = NO_INDEX;
+
+        if (*s == T_IF) {
+            s += 1;
+
+            // Look for "IF X < k THEN", "IF X > k THEN", or "IF X = k THEN".
+            var = parse_range_variable(&s);
+            if_op = *s;
+            or_equal = (if_op == T_LESS_THAN || if_op == T_GREATER_THAN) && s[1] == T_EQUAL;
+            if (or_equal) {
+                s += 1;
+            }
+            if (var != NO_INDEX &&
+                    (if_op == T_LESS_THAN || if_op == T_GREATER_THAN || if_op == T_EQUAL) &&
+                    parse_token_constant(&s, *s, &if_value) && *s == T_THEN) {
+
+                if_var = var;
+
+                // Turn "<=" and ">=" into "<" and ">".
+                if (or_equal) {
+                    if_value += if_op == T_LESS_THAN ? 1 : -1;
+                }
+            }
+
+            // Skip the rest of the condition. Nothing is assigned by "IF ... GOTO".
+            while (*s != T_THEN && *s != T_GOTO && *s != '\0') {
+                s += 1;
+            }
+            if (*s != T_THEN) {
+                break;
+            }
+            s += 1;
+
+            // An IF right after an increment can reset its variable, which
+            // keeps it in range.
+            if (previous != NO_INDEX && if_var == g_increment[previous].var &&
+                    g_increment[previous].guard == GUARD_NONE &&
+                    g_increment[previous].delta > 0 &&
+                    (if_op == T_EQUAL || if_op == T_GREATER_THAN)) {
+
+                uint8_t *t = s;
+
+                if (parse_range_variable(&t) == if_var &&
+                        parse_token_constant(&t, T_EQUAL, &value) &&
+                        IS_END_OF_STATEMENT(*t)) {
+
+                    Increment *inc = &g_increment[previous];
+
+                    if (if_op == T_EQUAL) {
+                        inc->guard = GUARD_RESET_EQ;
+                        inc->limit = if_value;
+                    } else {
+                        inc->guard = GUARD_RESET_GTE;
+                        inc->limit = if_value + 1;
+                    }
+                }
+            }
+
+            // The THEN clause is the next statement.
+            continue;
+        } else if (*s == T_FOR) {
+            int16_t start, end;
+            int16_t step = 1;
+
+            s += 1;
+            var = parse_range_variable(&s);
+            if (var != NO_INDEX) {
+                if (parse_token_constant(&s, T_EQUAL, &start) &&
+                        parse_token_constant(&s, T_TO, &end) &&
+                        (IS_END_OF_STATEMENT(*s) ||
+                         (parse_token_constant(&s, T_STEP, &step) && IS_END_OF_STATEMENT(*s)))) {
+
+                    // The loop ends one step past the end value, or past the
+                    // start if the loop runs only once.
+                    add_to_range(var, start);
+                    if (step >= 0) {
+                        add_to_range(var, (start > end ? start : end) + step);
+                    } else {
+                        add_to_range(var, (start < end ? start : end) + step);
+                    }
+                } else {
+                    g_range[var].unbounded = 1;
+                }
+            }
+        } else if (*s == T_READ) {
+            s += 1;
+
+            // Each variable can get any DATA item.
+            while (IS_FIRST_VARIABLE_LETTER(*s)) {
+                var = parse_range_variable(&s);
+                if (var != NO_INDEX && g_data_count != 0) {
+                    add_to_range(var, g_data_low);
+                    add_to_range(var, g_data_high);
+                }
+                s = skip_to_separator(s);
+                if (*s != ',') {
+                    break;
+                }
+                s += 1;
+            }
+        } else if (*s == T_GET) {
+            s += 1;
+            var = parse_range_variable(&s);
+            if (var != NO_INDEX) {
+                add_to_range(var, 127);
+            }
+        } else if (*s == T_REM) {
+            break;
+        } else if (*s == T_CALL) {
+            // Machine language can change any variable.
+            for (var = 0; var < MAX_VARIABLES; var++) {
+                g_range[var].unbounded = 1;
+            }
+        } else if (IS_FIRST_VARIABLE_LETTER(*s)) {
+            var = parse_range_variable(&s);
+            if (var != NO_INDEX && *s == T_EQUAL) {
+                uint8_t *t = s;
+                uint8_t *u = s + 1;
+
+                if (parse_token_constant(&t, T_EQUAL, &value) && IS_END_OF_STATEMENT(*t)) {
+                    add_to_range(var, value);
+                } else if (u[0] == T_KEY && IS_END_OF_STATEMENT(u[1])) {
+                    // A key or 0.
+                    add_to_range(var, 127);
+                } else if (parse_range_variable(&u) == var &&
+                        (*u == T_PLUS || *u == T_MINUS) && u[1] == '1' &&
+                        IS_END_OF_STATEMENT(u[2])) {
+
+                    if (g_increment_count == MAX_INCREMENTS) {
+                        g_range[var].unbounded = 1;
+                    } else {
+                        Increment *inc = &g_increment[g_increment_count];
+
+                        inc->var = var;
+                        inc->delta = *u == T_PLUS ? 1 : -1;
+                        inc->guard = GUARD_NONE;
+
+                        // "IF X < k THEN X = X + 1" and "IF X > k THEN X = X - 1"
+                        // can't go past k.
+                        if (guard_var == var &&
+                                if_op == (inc->delta > 0 ? T_LESS_THAN : T_GREATER_THAN)) {
+
+                            inc->guard = GUARD_BEFORE;
+                            inc->limit = if_value;
+                        }
+
+                        pending = g_increment_count++;
+                    }
+                } else {
+                    g_range[var].unbounded = 1;
+                }
+            }
+        }
+
+        // Skip to the next statement.
+        while (!IS_END_OF_STATEMENT(*s)) {
+            s += 1;
+        }
+        if (*s == ':') {
+            s += 1;
+        }
+    }
+
+    return pending;
+}
+
+/**
+ * Widen the range of a variable by the values an increment can give it.
+ * Returns whether the range changed.
+ */
+static uint8_t widen_by_increment(Increment *inc) {
+    Range *r = &g_range[inc->var];
+    uint8_t low = r->low;
+    uint8_t high = r->high;
+    int16_t next;
+
+    if (r->unbounded) {
+        return 0;
+    }
+
+    if (inc->guard == GUARD_BEFORE) {
+        // The statement only runs while the variable is short of the limit.
+        if (inc->delta > 0) {
+            if (r->low >= inc->limit) {
+                return 0;
+            }
+            next = r->high + 1;
+            if (next > inc->limit) {
+                next = inc->limit;
+            }
+        } else {
+            if (r->high <= inc->limit) {
+                return 0;
+            }
+            next = r->low - 1;
+            if (next < inc->limit) {
+                next = inc->limit;
+            }
+        }
+    } else if (inc->guard == GUARD_RESET_EQ) {
+        // The variable briefly holds the limit before being reset. If it can
+        // get past the limit, nothing stops it.
+        next = r->high + 1;
+        if (next > inc->limit || next > 255) {
+            next = -1;
+        } else if (next == inc->limit) {
+            return 0;
+        }
+    } else if (inc->guard == GUARD_RESET_GTE) {
+        // The variable briefly holds one more than its range before being
+        // reset if it's reached the limit.
+        next = r->high + 1;
+        if (next > 255) {
+            next = -1;
+        } else if (next >= inc->limit) {
+            return 0;
+        }
+    } else {
+        next = -1;
+    }
+
+    add_to_range(inc->var, next);
+
+    return r->unbounded || r->low != low || r->high != high;
+}
+
+/**
+ * Find which integer variables of the stored program stay in 0 to 255, so
+ * that they can be compiled as bytes. The analysis ignores control flow:
+ * a variable's range includes every value it's ever assigned.
+ */
+static void analyze_ranges(void) {
+    uint8_t *line = g_program;
+    uint8_t *next_line;
+    uint8_t pending = NO_INDEX;
+    uint8_t changed;
+    uint8_t i;
+
+    // Variables start at zero.
+    memset(g_range, 0, sizeof(g_range));
+    g_increment_count = 0;
+
+    while ((next_line = get_next_line(line)) != 0) {
+        pending = analyze_line(line + LINE_TEXT_OFFSET, pending);
+        line = next_line;
+    }
+
+    // Apply increments until the ranges settle. Each pass either grows a
+    // range or makes it unbounded, so this ends.
+    do {
+        changed = 0;
+        for (i = 0; i < g_increment_count; i++) {
+            if (widen_by_increment(&g_increment[i])) {
+                changed = 1;
+            }
+        }
+    } while (changed);
+}
+
+/**
+ * Parse a DATA item, an integer constant with an optional sign. Returns
+ * the pointer past it, or 0 if it's not valid.
+ */
+static uint8_t *parse_data_item(uint8_t *s, int16_t *value) {
+    uint8_t negative = *s == T_MINUS;
+
+    if (negative || *s == T_PLUS) {
+        s += 1;
+    }
+    if (!IS_DIGIT(*s)) {
+        return 0;
+    }
+    *value = parse_uint16(&s);
+    if (negative) {
+        *value = -*value;
+    }
+
+    return *s == ',' || IS_END_OF_STATEMENT(*s) ? s : 0;
+}
+
+/**
+ * Go through the items of all DATA statements in the stored program,
+ * counting them in g_data_count. If the table is not 0, store each item
+ * in it, with the low byte at its index and the high byte at its index
+ * plus the count.
+ */
+static void scan_data(uint8_t *table, uint8_t count) {
+    uint8_t *line = g_program;
+    uint8_t *next_line;
+
+    g_data_count = 0;
+
+    while ((next_line = get_next_line(line)) != 0) {
+        uint8_t *s = line + LINE_TEXT_OFFSET;
+
+        while (*s != '\0' && *s != T_REM) {
+            if (*s == T_DATA) {
+                uint8_t *end;
+                int16_t value;
+
+                s += 1;
+                while ((end = parse_data_item(s, &value)) != 0 && g_data_count < MAX_DATA) {
+                    if (table != 0) {
+                        table[g_data_count] = value & 0xFF;
+                        table[count + g_data_count] = value >> 8;
+                    } else {
+                        if (g_data_count == 0 || value < g_data_low) {
+                            g_data_low = value;
+                        }
+                        if (g_data_count == 0 || value > g_data_high) {
+                            g_data_high = value;
+                        }
+                    }
+                    g_data_count += 1;
+
+                    s = end;
+                    if (*s == ',') {
+                        s += 1;
+                    }
+                }
+            } else {
+                s += 1;
+            }
+        }
+
+        line = next_line;
+    }
+}
+
+/**
+ * Gather the items of the DATA statements into a table at the start of
+ * the compiled program, with a jump over it. Only the low bytes are
+ * stored if every item fits in a byte. READ then loads straight from the
+ * table, with the index of the next item in DATA_INDEX.
+ */
+static void layout_data(void) {
+    uint8_t *jump = g_c;
+
+    scan_data(0, 0);
+    if (g_data_count == 0) {
+        return;
+    }
+
+    g_data_bytes = g_data_low >= 0 && g_data_high <= 255;
+    g_data_table = jump + 3;
+    scan_data(g_data_table, g_data_count);
+    g_c = g_data_table + (g_data_bytes ? g_data_count : 2*g_data_count);
+
+    jump[0] = I_JMP_ABS;
+    jump[1] = ADDRESS(g_c) & 0xFF;
+    jump[2] = ADDRESS(g_c) >> 8;
+}
+
+/**
+ * Record the arrays dimensioned by the DIM statement whose arguments are
+ * at s. Returns the pointer past them.
+ */
+static uint8_t *layout_dim(uint8_t *s) {
+    while (IS_FIRST_VARIABLE_LETTER(*s)) {
+        VarInfo *var = find_variable(&s);
+        int16_t size;
+
+        if (var == 0 || !IS_ARRAY(var->data_type)) {
+            break;
+        } else {
+            ArrayInfo *a = &g_array_info[var - g_variables];
+            uint8_t *first = s + 1;
+
+            a->dim_count += 1;
+            if (parse_token_constant(&s, '(', &size) && (*s == ')' || *s == ',') &&
+                    size >= 0) {
+
+                a->size = size + 1;
+            } else {
+                s = skip_to_separator(first);
+            }
+
+            // Number of columns of a two-dimensional array. The compiler
+            // only supports a constant.
+            if (*s == ',' && parse_token_constant(&s, ',', &size) && *s == ')' &&
+                    size >= 0 && a->columns == 0) {
+
+                a->columns = size + 1;
+            }
+        }
+
+        // Skip the rest of the sizes, then to the next array.
+        while (*s == ',') {
+            s = skip_to_separator(s + 1);
+        }
+        while (!IS_END_OF_STATEMENT(*s) && *s != ',') {
+            s += 1;
+        }
+        if (*s == ',') {
+            s += 1;
+        }
+    }
+
+    return s;
+}
+
+/**
+ * Allocate arrays at compile time, at the start of g_arrays. That's
+ * possible for an array with a single DIM statement of constant size,
+ * since running that statement a second time is an error. Compiled code
+ * then uses the array's fixed address instead of the pointer in its
+ * variable. The layout is kept after the program runs, so that immediate
+ * mode statements find the arrays where the program left them.
+ */
+static void layout_arrays(void) {
+    uint8_t *line = g_program;
+    uint8_t *next_line;
+    uint8_t i;
+
+    memset(g_array_info, 0, sizeof(g_array_info));
+    g_static_array_words = 0;
+
+    while ((next_line = get_next_line(line)) != 0) {
+        uint8_t *s = line + LINE_TEXT_OFFSET;
+
+        while (*s != '\0' && *s != T_REM) {
+            s = *s == T_DIM ? layout_dim(s + 1) : s + 1;
+        }
+
+        line = next_line;
+    }
+
+    for (i = 0; i < MAX_VARIABLES; i++) {
+        ArrayInfo *a = &g_array_info[i];
+        // Two byte elements per word.
+        uint8_t word_shift = ELEMENT_TYPE(g_variables[i].data_type) == DT_BYTE;
+        uint16_t room = MAX_ARRAY_WORDS - g_static_array_words;
+        uint32_t elements = a->size;
+        uint32_t words;
+
+        a->stride = a->columns;
+        if (a->dim_count == 1 && a->size != 0) {
+            if (a->columns != 0) {
+                // Round the stride up to a power of two if there's room.
+                uint16_t stride = 1;
+
+                while (stride < a->columns) {
+                    stride <<= 1;
+                }
+                if ((elements*stride + word_shift) >> word_shift <= room) {
+                    a->stride = stride;
+                }
+                elements *= a->stride;
+            }
+
+            words = (elements + word_shift) >> word_shift;
+            if (words <= room) {
+                a->address = (uint8_t *) (g_arrays + g_static_array_words);
+                a->size = elements;
+                g_static_array_words += words;
+            } else {
+                a->size = 0;
+            }
+        }
+    }
+}
+
+/**
+ * Call to configure the compilation step.
+ */
+static void set_up_compile(void) {
+    uint8_t i;
+
+    g_c = g_compiled;
+    g_line_info_count = 0;
+    g_forward_goto_count = 0;
+
+    // Let run-time errors abort the program.
+    add_call(enter_program);
+
+    // Only the stored program has DATA.
+    g_data_count = 0;
+
+    // Variables are 16 bits unless analyze_ranges() finds otherwise.
+    for (i = 0; i < MAX_VARIABLES; i++) {
+        g_range[i].unbounded = 1;
+    }
+}
+
+/**
+ * Generate code to load the next DATA item into AX, or to abort the program
+ * with an error if there are none left. Returns the type of the item.
+ */
+static uint8_t compile_read_data(void) {
+    uint16_t table = ADDRESS(g_data_table);
+    register uint8_t *c = g_c;
+
+    c[0] = I_LDY_ZPG;
+    c[1] = DATA_INDEX;
+    c[2] = I_CPY_IMM;
+    c[3] = g_data_count;
+    c[4] = I_BCC_REL;
+    c[5] = 5;                   // Skip the JSR and line number.
+    g_c = c + 6;
+    add_call_with_line(out_of_data_error_fast);
+
+    // Low bytes, then high bytes if the items don't all fit in a byte.
+    c = g_c;
+    c[0] = I_LDA_ABS_Y;
+    c[1] = table & 0xFF;
+    c[2] = table >> 8;
+    c += 3;
+    if (g_data_bytes) {
+        c[0] = I_LDX_IMM;
+        c[1] = 0;
+        c += 2;
+    } else {
+        table += g_data_count;
+        c[0] = I_LDX_ABS_Y;
+        c[1] = table & 0xFF;
+        c[2] = table >> 8;
+        c += 3;
+    }
+    c[0] = I_INC_ZPG;
+    c[1] = DATA_INDEX;
+    g_c = c + 2;
+
+    return g_data_bytes ? DT_BYTE : DT_INT;
+}
+
+/**
+ * Generate code for RESTORE, to read from the first DATA item again.
+ */
+static void compile_restore(void) {
+    register uint8_t *c = g_c;
+
+    c[0] = I_LDA_IMM;
+    c[1] = 0;
+    c[2] = I_STA_ZPG;
+    c[3] = DATA_INDEX;
+    g_c = c + 4;
+}
+
+/**
+ * Compile an assignment to the variable or array element whose name is at
+ * s. The statement token is T_READ for the next DATA item, T_GET for the
+ * next key, or 0 for the expression after an equal sign. Returns the
+ * pointer past the statement, or 0 on a syntax error.
+ */
+static uint8_t *compile_assignment(uint8_t *s, uint8_t statement) {
+    VarInfo *var = find_variable(&s);
+    uint8_t var_addr;
+    uint8_t element_type;
+    uint8_t *end;
+    // Kind and value of a direct index (see is_direct_index()), or
+    // OPERAND_NONE.
+    uint8_t index_kind = OPERAND_NONE;
+    uint16_t index;
+    // Whether the low byte of the index is on the hardware stack.
+    uint8_t index_pushed = 0;
+    register uint8_t *c;
+
+    if (var == 0) {
+        // TODO: Nicer error specifically for out of variable space.
+        return 0;
+    }
+
+    var_addr = get_var_address(var);
+    element_type = ELEMENT_TYPE(get_var_type(var));
+
+    if (IS_ARRAY(var->data_type)) {
+        // Array element assignment.
+        ArrayRef ref;
+        uint8_t index_type;
+        uint8_t *push;
+
+        // Compile index expression. Skip open parenthesis.
+        s = compile_expression(s + 1);
+        index_type = g_expression_type;
+        ref.var = var;
+        ref.row = ROW_NONE;
+
+        if (*s == ',' && g_array_info[var - g_variables].columns != 0) {
+            // Row of a two-dimensional array, then column.
+            compile_row_offset(&ref, index_type);
+            push = g_c;
+            if (ref.row == ROW_PUSHED) {
+                add_call(pushax);
+            }
+            s = compile_expression(s + 1);
+            if (ref.row == ROW_PUSHED && g_operand.load == push + 3) {
+                // The column is its own expression. Let compile_add_row()
+                // remove our push along with the load of a simple column.
+                g_operand.push = push;
+            }
+            index_type = compile_add_row(&ref, g_expression_type);
+        }
+
+        if (*s != ')') {
+            return 0;
+        }
+        s += 1;
+        if (statement == 0 && *s != T_EQUAL) {
+            return 0;
+        }
+        compile_convert(index_type, DT_INT);
+        compile_bounds_check(var, index_type);
+
+        if (is_direct_index(var, index_type)) {
+            // Remove the load of the index, we'll use it after computing
+            // the value.
+            index_kind = g_operand.kind;
+            index = g_operand.value;
+            g_c = g_operand.load;
+        } else if (is_small_array(var)) {
+            // Only the low byte of the index is used, unchecked like the
+            // load in compile_array_load().
+            *g_c++ = I_PHA;
+            index_pushed = 1;
+        } else {
+            // Push element address onto the stack.
+            compile_element_address(var);
+            add_call(pushax);
+        }
+    }
+
+    if (statement == T_READ) {
+        compile_convert(compile_read_data(), element_type);
+    } else if (statement == T_GET) {
+        compile_key(1);
+        compile_convert(DT_BYTE, element_type);
+    } else if (*s != T_EQUAL) {
+        return 0;
+    } else if (!IS_ARRAY(var->data_type) &&
+            (end = compile_increment(var_addr, element_type, s + 1)) != 0) {
+
+        // Incremented or decremented in place.
+        return end;
+    } else {
+        // Parse value.
+        s = compile_expression(s + 1);
+        compile_convert(g_expression_type, element_type);
+    }
+
+    if (index_kind != OPERAND_NONE) {
+        compile_direct_access(var, index_kind, index, 1);
+    } else if (index_pushed) {
+        // Pull the index into Y.
+        c = g_c;
+        c[0] = I_STA_ZPG;
+        c[1] = ZP_ADDRESS(tmp1);
+        c[2] = I_PLA;
+        c[3] = I_TAY;
+        c[4] = I_LDA_ZPG;
+        c[5] = ZP_ADDRESS(tmp1);
+        g_c = c + 6;
+        compile_direct_access(var, OPERAND_NONE, 0, 1);
+    } else if (IS_ARRAY(var->data_type)) {
+        // Value is in AX, address is on top of stack. The staxspidx
+        // function uses Y as an index, so must zero it out.
+        *g_c++ = I_LDY_IMM;
+        *g_c++ = 0;
+        add_call(element_type == DT_BYTE ? staspidx : staxspidx);
+    } else if (element_type == DT_BYTE) {
+        // Copy low byte to var.
+        g_c[0] = I_STA_ZPG;
+        g_c[1] = var_addr;
+        g_c += 2;
+    } else {
+        // Copy to var.
+        compile_store_zero_page(var_addr);
+    }
+
+    return s;
+}
+
+/**
+ * If the pointer is at a whole array, such as "A()", returns its variable and
+ * moves the pointer past it. Otherwise returns 0.
+ */
+static VarInfo *parse_whole_array(uint8_t **s_ptr) {
+    uint8_t *s = *s_ptr;
+    VarInfo *var;
+
+    if (!IS_FIRST_VARIABLE_LETTER(*s)) {
+        return 0;
+    }
+    var = find_variable(&s);
+    if (var == 0 || !IS_ARRAY(var->data_type) || s[0] != '(' || s[1] != ')') {
+        return 0;
+    }
+    *s_ptr = s + 2;
+
+    return var;
+}
+
+/**
+ * Generate code to load the address of an array's elements into AX. For a
+ * small word array, that's the start of its low byte plane.
+ */
+static void compile_array_start(VarInfo *var) {
+    uint8_t *address = get_array_address(var);
+
+    if (address != 0) {
+        compile_load_ax(ADDRESS(address));
+    } else {
+        compile_load_zero_page(get_var_address(var));
+    }
+}
+
+/**
+ * Generate code to load the number of elements of an array into AX, or if
+ * bytes is set, the number of bytes they take. For a small word array, that's
+ * the size of one byte plane. An array that hasn't been DIM'ed has none.
+ */
+static void compile_array_size(VarInfo *var, uint8_t bytes) {
+    ArrayInfo *a = &g_array_info[var - g_variables];
+    uint16_t limit = ADDRESS(&g_array_limits[var - g_variables]);
+    uint8_t is_word = bytes && ELEMENT_TYPE(var->data_type) != DT_BYTE;
+    register uint8_t *c;
+
+    if (a->address != 0) {
+        compile_load_ax(is_word && !is_small_array(var) ? a->size*2 : a->size);
+    } else {
+        c = g_c;
+        c[0] = I_LDA_ABS;
+        c[1] = limit & 0xFF;
+        c[2] = limit >> 8;
+        c[3] = I_LDX_ABS;
+        c[4] = (limit + 1) & 0xFF;
+        c[5] = (limit + 1) >> 8;
+        c += 6;
+        if (is_word) {
+            // Two bytes per element. Shift the high byte through tmp1.
+            c[0] = I_STX_ZPG;
+            c[1] = ZP_ADDRESS(tmp1);
+            c[2] = I_ASL_A;
+            c[3] = I_ROL_ZPG;
+            c[4] = ZP_ADDRESS(tmp1);
+            c[5] = I_LDX_ZPG;
+            c[6] = ZP_ADDRESS(tmp1);
+            c += 7;
+        }
+        g_c = c;
+    }
+}
+
+/**
+ * Compile "FILL address, length, value", which sets length bytes at the
+ * address to the value, or "FILL A(), value", which sets every element of
+ * the array. The pointer is just past the FILL. Returns the pointer past the
+ * statement, or 0 on a syntax error.
+ */
+static uint8_t *compile_fill(uint8_t *s) {
+    VarInfo *var = parse_whole_array(&s);
+    uint8_t element_type;
+    register uint8_t *c;
+
+    if (var == 0) {
+        s = compile_int_expression(s);
+        add_call(pushax);
+        if (*s != ',') {
+            return 0;
+        }
+        s = compile_int_expression(s + 1);
+        add_call(pushax);
+        if (*s != ',') {
+            return 0;
+        }
+        s = compile_int_expression(s + 1);
+        add_call(fill_memory);
+
+        return s;
+    }
+
+    if (*s != ',') {
+        return 0;
+    }
+    element_type = ELEMENT_TYPE(var->data_type);
+
+    compile_array_start(var);
+    add_call(pushax);
+    compile_array_size(var, 1);
+    add_call(pushax);
+    s = compile_expression(s + 1);
+    compile_convert(g_expression_type, element_type);
+
+    if (element_type == DT_BYTE) {
+        add_call(fill_memory);
+    } else if (!is_small_array(var)) {
+        add_call(fill_word_memory);
+    } else {
+        uint16_t size = g_array_info[var - g_variables].size;
+
+        // Fill the low byte plane, keeping the high byte on the hardware
+        // stack for the high byte plane.
+        c = g_c;
+        c[0] = I_TAY;
+        c[1] = I_TXA;
+        c[2] = I_PHA;
+        c[3] = I_TYA;
+        g_c = c + 4;
+        add_call(fill_memory);
+        compile_load_ax(ADDRESS(get_array_address(var)) + size);
+        add_call(pushax);
+        compile_load_ax(size);
+        add_call(pushax);
+        *g_c++ = I_PLA;
+        add_call(fill_memory);
+    }
+
+    return s;
+}
+
+/**
+ * Compile "MOVE source, destination, length", which copies length bytes, or
+ * "MOVE A(), B()", which copies every element of A to the same element of B.
+ * The arrays must have the same element type, and B must be at least as
+ * large as A. That's checked at compile time if both are allocated at compile
+ * time, and otherwise at run time in checked mode. The pointer is just past
+ * the MOVE. Returns the pointer past the statement, or 0 on a syntax error.
+ */
+static uint8_t *compile_move(uint8_t *s) {
+    VarInfo *from = parse_whole_array(&s);
+    VarInfo *to;
+    ArrayInfo *from_info;
+    ArrayInfo *to_info;
+    uint8_t is_word;
+    register uint8_t *c;
+
+    if (from == 0) {
+        s = compile_int_expression(s);
+        add_call(pushax);
+        if (*s != ',') {
+            return 0;
+        }
+        s = compile_int_expression(s + 1);
+        add_call(pushax);
+        if (*s != ',') {
+            return 0;
+        }
+        s = compile_int_expression(s + 1);
+        add_call(move_memory);
+
+        return s;
+    }
+
+    if (*s != ',') {
+        return 0;
+    }
+    s += 1;
+    to = parse_whole_array(&s);
+    if (to == 0 || ELEMENT_TYPE(from->data_type) != ELEMENT_TYPE(to->data_type)) {
+        return 0;
+    }
+
+    // A small word array is in two planes, so the other array must be too.
+    is_word = ELEMENT_TYPE(from->data_type) != DT_BYTE;
+    if (is_word && is_small_array(from) != is_small_array(to)) {
+        return 0;
+    }
+
+    from_info = &g_array_info[from - g_variables];
+    to_info = &g_array_info[to - g_variables];
+    if (from_info->address != 0 && to_info->address != 0) {
+        if (from_info->size > to_info->size) {
+            return 0;
+        }
+    } else if (g_check_bounds) {
+        // The last element of the source must be in the destination.
+        compile_array_size(from, 0);
+        c = g_c;
+        c[0] = I_SEC;
+        c[1] = I_SBC_IMM;
+        c[2] = 1;
+        c[3] = I_BCS_REL;
+        c[4] = 1;               // Skip the borrow.
+        c[5] = I_DEX;
+        g_c = c + 6;
+        compile_bounds_check(to, DT_INT);
+    }
+
+    if (is_word && is_small_array(from)) {
+        // Low byte planes, then high byte planes.
+        compile_load_ax(ADDRESS(from_info->address));
+        add_call(pushax);
+        compile_load_ax(ADDRESS(to_info->address));
+        add_call(pushax);
+        compile_load_ax(from_info->size);
+        add_call(move_memory);
+        compile_load_ax(ADDRESS(from_info->address) + from_info->size);
+        add_call(pushax);
+        compile_load_ax(ADDRESS(to_info->address) + to_info->size);
+        add_call(pushax);
+        compile_load_ax(from_info->size);
+    } else {
+        compile_array_start(from);
+        add_call(pushax);
+        compile_array_start(to);
+        add_call(pushax);
+        compile_array_size(from, 1);
+    }
+    add_call(move_memory);
+
+    return s;
+}
+
+/**
+ * Compile a DRAW coordinate and push it on the hardware stack. draw_fast()
+ * only takes a byte, so a coordinate past 255 (or negative) is pushed as
+ * 255, which it clips like any other off the screen. Returns the pointer
+ * past the expression.
+ */
+static uint8_t *compile_draw_coordinate(uint8_t *s) {
+    uint8_t type;
+    register uint8_t *c;
+
+    s = compile_expression(s);
+    type = g_expression_type;
+    compile_convert(type, DT_INT);
+
+    c = g_c;
+    if (get_operand_kind() == OPERAND_CONSTANT) {
+        c = g_operand.load;
+        c[0] = I_LDA_IMM;
+        c[1] = g_operand.value > 255 ? 255 : g_operand.value;
+        c += 2;
+    } else if (type != DT_BYTE) {
+        c[0] = I_CPX_IMM;
+        c[1] = 0;
+        c[2] = I_BEQ_REL;
+        c[3] = 2;                   // Skip the 255.
+        c[4] = I_LDA_IMM;
+        c[5] = 255;
+        c += 6;
+    }
+    c[0] = I_PHA;
+    g_c = c + 1;
+
+    return s;
+}
+
+/**
+ * Compile "DRAW S@(), X, Y, T", which draws the shape in the two-dimensional
+ * byte array S@ on the low-res screen with its top-left pixel at (X,Y),
+ * skipping pixels of color T. Element S@(R,C) is the color of row R and
+ * column C. The array must be allocated at compile time, so that its size
+ * is known. The pointer is just past the DRAW. Returns the pointer past the
+ * statement, or 0 on a syntax error.
+ */
+static uint8_t *compile_draw(uint8_t *s) {
+    VarInfo *var = parse_whole_array(&s);
+    ArrayInfo *a;
+    uint16_t rows;
+    register uint8_t *c;
+
+    if (var == 0 || ELEMENT_TYPE(var->data_type) != DT_BYTE) {
+        return 0;
+    }
+    a = &g_array_info[var - g_variables];
+    if (a->address == 0 || a->columns == 0 || a->stride > 255) {
+        return 0;
+    }
+    rows = a->size/a->stride;
+
+    // X and Y coordinates on the hardware stack, transparent color in A.
+    if (*s != ',') {
+        return 0;
+    }
+    s = compile_draw_coordinate(s + 1);
+    if (*s != ',') {
+        return 0;
+    }
+    s = compile_draw_coordinate(s + 1);
+    if (*s != ',') {
+        return 0;
+    }
+    s = compile_int_expression(s + 1);
+    add_call(draw_fast);
+
+    c = g_c;
+    c[0] = ADDRESS(a->address) & 0xFF;
+    c[1] = ADDRESS(a->address) >> 8;
+    c[2] = a->columns;
+    c[3] = rows > 255 ? 255 : rows;
+    c[4] = a->stride;
+    g_c = c + 5;
+
+    return s;
+}
+
+/**
+ * Compile the tokenized line of BASIC, adding it to the g_compiled binary.
+ */
+static void compile_buffer(uint8_t *buffer, uint16_t line_number) {
+    uint8_t *s = buffer;
+    uint8_t done;
+    // Keep track of addresses that point to the end of the line.
+    uint8_t *end_of_line_address[4];
+    uint8_t end_of_line_count = 0;
+    register uint8_t *c;
+
+    g_line_number = line_number;
+
+    do {
+        int8_t error = 0;
+        int8_t continue_statement = 0;
+
+        // Default to being done after one statement.
+        done = 1;
+
+        if (*s == '\0' || *s == ':') {
+            // Empty statement. We skip the colon below.
+        } else if (IS_FIRST_VARIABLE_LETTER(*s)) {
+            // Must be variable assignment.
+            uint8_t *end = compile_assignment(s, 0);
+
+            if (end == 0) {
+                error = 1;
+            } else {
+                s = end;
+            }
+        } else if (*s == T_READ) {
+            s += 1;
+
+            while (1) {
+                uint8_t *end = compile_assignment(s, T_READ);
+
+                if (end == 0) {
+                    error = 1;
+                    break;
+                }
+                s = end;
+                if (*s != ',') {
+                    break;
+                }
+                s += 1;
+            }
+        } else if (*s == T_GET) {
+            uint8_t *end = IS_FIRST_VARIABLE_LETTER(s[1]) ?
+                compile_assignment(s + 1, T_GET) : 0;
+
+            if (end == 0) {
+                error = 1;
+            } else {
+                s = end;
+            }
+        } else if (*s == T_DATA) {
+            // Gathered by layout_data(), nothing to run. Check the syntax.
+            uint8_t *end;
+            int16_t value;
+
+            s += 1;
+            while ((end = parse_data_item(s, &value)) != 0 && *end == ',') {
+                s = end + 1;
+            }
+            if (end == 0) {
+                error = 1;
+            } else {
+                s = end;
+            }
+        } else if (*s == T_RESTORE) {
+            s += 1;
+            compile_restore();
+        } else if (*s == T_HOME) {
+            s += 1;
+            add_call(home);
+        } else if (*s == T_PRINT) {
+            s += 1;
+
+            if (*s != '\0' && *s != ':') {
+                // Parse expression.
+                s = compile_expression(s);
+                add_call(g_expression_type == DT_FIXED ? (void *) print_fixed : (void *) print_int_fast);
+            }
+
+            if (*s == ';') {
+                // Ends with a semicolon, don't print newline.
+                s += 1;
+            } else {
+                add_call(print_newline);
+            }
+        } else if (*s == T_LIST) {
+            s += 1;
+            add_call(list_statement);
+        } else if (*s == T_POKE) {
+            uint8_t constant_address;
+            uint16_t address = 0;
+
+            s += 1;
+            // Parse address. A constant one is stored to directly, otherwise
+            // it's kept on the stack while the value is computed.
+            s = compile_int_expression(s);
+            constant_address = get_operand_kind() == OPERAND_CONSTANT;
+            if (constant_address) {
+                address = g_operand.value;
+                g_c = g_operand.load;
+            } else {
+                add_call(pushax);
+            }
+            if (*s != ',') {
+                error = 1;
+            } else {
+                s++;
+                // Parse value. LSB is in A.
+                s = compile_int_expression(s);
+                if (get_operand_kind() == OPERAND_CONSTANT) {
+                    // Only the low byte is needed.
+                    c = g_operand.load;
+                    c[0] = I_LDA_IMM;
+                    c[1] = g_operand.value;
+                    g_c = c + 2;
+                }
+                c = g_c;
+                if (constant_address) {
+                    c[0] = I_STA_ABS;
+                    c[1] = address & 0xFF;
+                    c[2] = address >> 8;
+                    g_c = c + 3;
+                } else {
+                    c[0] = I_LDY_IMM;        // Zero out Y.
+                    c[1] = 0;
+                    g_c = c + 2;
+                    add_call(staspidx);      // Store at address on stack and pop it.
+                }
+            }
+        } else if (*s == T_DRAW) {
+            uint8_t *end = compile_draw(s + 1);
+
+            if (end == 0) {
+                error = 1;
+            } else {
+                s = end;
+            }
+        } else if (*s == T_FILL || *s == T_MOVE) {
+            uint8_t *end = *s == T_FILL ? compile_fill(s + 1) : compile_move(s + 1);
+
+            if (end == 0) {
+                error = 1;
+            } else {
+                s = end;
+            }
+        } else if (*s == T_CALL) {
+            s += 1;
+            // Parse address. Call a constant one directly.
+            s = compile_int_expression(s);
+            if (get_operand_kind() == OPERAND_CONSTANT) {
+                g_c = g_operand.load;
+                add_call_address(g_operand.value);
+            } else {
+                add_call(call_ax);
+            }
+        } else if (*s == T_GOTO) {
+            s += 1;
+
+            if (!IS_DIGIT(*s)) {
+                error = 1;
+            } else {
+                uint16_t target_line_number = parse_uint16(&s);
+
+                if (!compile_jump_to_line(I_JMP_ABS, line_number, target_line_number)) {
+                    error = 1;
+                }
+            }
+        } else if (*s == T_GOSUB) {
+            s += 1;
+
+            if (!IS_DIGIT(*s)) {
+                error = 1;
+            } else {
+                uint16_t target_line_number = parse_uint16(&s);
+
+                compile_gosub_guard();
+
+                // The subroutine's RETURN comes back here.
+                if (!compile_jump_to_line(I_JSR, line_number, target_line_number)) {
+                    error = 1;
+                }
+            }
+        } else if (*s == T_ON) {
+            uint8_t *end = compile_on(s + 1, line_number);
+
+            if (end == 0) {
+                error = 1;
+            } else {
+                s = end;
+            }
+        } else if (*s == T_RETURN) {
+            s += 1;
+            compile_return_guard();
+            add_return();
+        } else if (*s == T_POP) {
+            // Drop the return address of the innermost GOSUB.
+            s += 1;
+            compile_return_guard();
+            c = g_c;
+            c[0] = I_PLA;
+            c[1] = I_PLA;
+            g_c = c + 2;
+        } else if (*s == T_IF) {
+            // Save where we are in case we need to roll back.
+            uint8_t *saved_c = g_c;
+
+            s += 1;
+            // Parse conditional expression.
+            s = compile_expression(s);
+            // Check if AX is zero. Or the two bytes together, through the zero page.
+            c = g_c;
+            c[0] = I_STX_ZPG;
+            c[1] = ZP_ADDRESS(tmp1);
+            c[2] = I_ORA_ZPG;
+            c[3] = ZP_ADDRESS(tmp1);
+            // If so, skip to end of this line.
+            c[4] = I_BNE_REL;
+            c[5] = 3; // Skip over absolute jump.
+            c[6] = I_JMP_ABS;
+            c += 7;
+            // TODO Check for overflow of end_of_line_address:
+            end_of_line_address[end_of_line_count++] = c;
+            c[0] = 0; // Address of next line.
+            c[1] = 0; // Address of next line.
+            g_c = c + 2;
+
+            if (*s == T_THEN) {
+                // Skip THEN and continue
+                s += 1;
+                continue_statement = 1;
+            } else if (*s == T_GOTO) {
+                // Just continue, we'll pick it up after the loop.
+                continue_statement = 1;
+            } else {
+                // Must be THEN or GOTO. Erase what we've done.
+                g_c = saved_c;
+                error = 1;
+            }
+        } else if (*s == T_FOR) {
+            s += 1;
+
+            // We'll set this to 0 if we succeed.
+            error = 1;
+
+            if (IS_FIRST_VARIABLE_LETTER(*s)) {
+                VarInfo *var = find_variable(&s);
+
+                if (var == 0) {
+                    // TODO: Nicer error specifically for out of variable space.
+                } else if (IS_ARRAY(var->data_type)) {
+                    // Syntax error, can't use array index for FOR loop variable.
+                } else {
+                    uint8_t var_addr = get_var_address(var);
+                    uint8_t var_type = get_var_type(var);
+
+                    if (*s == T_EQUAL) {
+                        s += 1;
+
+                        // Parse initial value.
+                        s = compile_expression(s);
+                        compile_convert(g_expression_type, var_type);
+
+                        // Copy to var.
+                        compile_store_zero_page(var_addr);
+
+                        if (*s == T_TO) {
+                            s += 1;
+
+                            // Parse end value and push it on the hardware
+                            // stack, low byte first.
+                            s = compile_expression(s);
+                            compile_convert(g_expression_type, var_type);
+                            c = g_c;
+                            c[0] = I_PHA;
+                            c[1] = I_TXA;
+                            c[2] = I_PHA;
+                            g_c = c + 3;
+
+                            if (*s == T_STEP) {
+                                s += 1;
+
+                                // Parse step.
+                                s = compile_expression(s);
+                                compile_convert(g_expression_type, var_type);
+                            } else {
+                                // Default to step of 1.
+                                compile_load_ax(var_type == DT_FIXED ? 0x100 : 1);
+                            }
+
+                            // The top of the loop is right after the call,
+                            // so for_fast figures it out from its return address.
+                            add_call_with_var(for_fast, var_addr, line_number);
+                            error = 0;
+                        }
+                    }
+                }
+            }
+        } else if (*s == T_NEXT) {
+            // Zero means find the most recent FOR loop.
+            uint8_t var_addr = 0;
+
+            s += 1;
+
+            // See if there's the optional variable. We don't support multiple
+            // variables ("NEXT I,J").
+            if (IS_FIRST_VARIABLE_LETTER(*s)) {
+                VarInfo *var = find_variable(&s);
+                if (var == 0) {
+                    // TODO: Nicer error specifically for out of variable space.
+                    error = 1;
+                } else {
+                    var_addr = get_var_address(var);
+                }
+            }
+
+            // Process the NEXT instruction. The next_fast routine either
+            // jumps to the top of the loop or returns after its arguments.
+            add_call_with_var(next_fast, var_addr, line_number);
+        } else if (*s == T_DIM) {
+            s += 1;
+
+            while (1) {
+                // Expect variable name.
+                if (!IS_FIRST_VARIABLE_LETTER(*s)) {
+                    error = 1;
+                } else {
+                    VarInfo *var = find_variable(&s);
+
+                    if (var == 0) {
+                        // TODO handle error.
+                        error = 1;
+                    } else {
+                        // Must be an array variable.
+                        if (!IS_ARRAY(var->data_type)) {
+                            // TODO handle error.
+                            error = 1;
+                        } else {
+                            uint8_t var_addr = get_var_address(var);
+                            ArrayInfo *a = &g_array_info[var - g_variables];
+                            uint16_t columns;
+
+                            // Put array address in AX.
+                            compile_load_zero_page(var_addr);
+
+                            // See if we have an address. If yes, then we've been
+                            // dimensioned before.
+                            c = g_c;
+                            c[0] = I_STX_ZPG;
+                            c[1] = ZP_ADDRESS(tmp1);
+                            c[2] = I_ORA_ZPG;
+                            c[3] = ZP_ADDRESS(tmp1);
+                            c[4] = I_BEQ_REL;     // If zero, branch to actual work.
+                            c[5] = 10;            // Load, call, and abort.
+                            g_c = c + 6;
+                            compile_load_ax(line_number);
+                            add_call(redimd_array_error);
+                            add_abort();
+
+                            // Assume we're followed by an open parenthesis. Parse
+                            // expression for the size of the array.
+                            s = compile_int_expression(s + 1);
+
+                            if (*s == ',') {
+                                // Two-dimensional. The number of columns must be
+                                // a constant, the same in every DIM of the array.
+                                s += 1;
+                                if (!IS_DIGIT(*s)) {
+                                    error = 1;
+                                } else {
+                                    columns = parse_uint16(&s) + 1;
+                                    if (a->columns == 0) {
+                                        // Immediate mode, not seen by
+                                        // layout_arrays().
+                                        a->columns = columns;
+                                        a->stride = columns;
+                                    } else if (columns != a->columns) {
+                                        error = 1;
+                                    }
+                                }
+
+                                if (get_array_address(var) == 0) {
+                                    // The allocated size is the number of rows
+                                    // times the stride, minus one.
+                                    compile_multiply_by_stride(a->stride);
+                                    compile_add_constant(a->stride - 1);
+                                }
+                            }
+
+                            if (*s != ')' || error) {
+                                error = 1;
+                            } else if (get_array_address(var) != 0) {
+                                s += 1;
+
+                                // Allocated at compile time. Replace the constant
+                                // size with the array's address.
+                                g_c = g_operand.load;
+                                compile_load_ax(ADDRESS(get_array_address(var)));
+                                compile_store_zero_page(var_addr);
+                            } else {
+                                s += 1;
+
+                                // AX now holds the size of the array. Y holds the
+                                // address in zero page where the array address
+                                // should be stored.
+                                g_c[0] = I_LDY_IMM;
+                                g_c[1] = var_addr;
+                                g_c += 2;
+
+                                // Call a runtime routine to allocate it.
+                                add_call(ELEMENT_TYPE(var->data_type) == DT_BYTE ?
+                                        allocate_byte_array_fast : allocate_array_fast);
+                            }
+                        }
+                    }
+                }
+
+                if (*s == ',') {
+                    // More variables to dim.
+                    s += 1;
+                } else {
+                    // We're done.
+                    break;
+                }
+            }
+        } else if (*s == T_REM) {
+            // Done with line.
+            break;
+        } else if (*s == T_GR) {
+            s += 1;
+            add_call(gr_statement);
+        } else if (*s == T_TEXT) {
+            s += 1;
+            add_call(text_statement);
+        } else if (*s == T_COLOR) {
+            s += 1;
+            if (*s != T_EQUAL) {
+                error = 1;
+            } else {
+                s = compile_int_expression(s + 1);
+                add_call(color_fast);
+            }
+        } else if (*s == T_PLOT) {
+            s += 1;
+            s = compile_int_expression(s);
+            if (*s != ',') {
+                error = 1;
+            } else {
+                s += 1;
+
+                // Save the X coordinate on the hardware stack.
+                *g_c++ = I_PHA;
+                s = compile_int_expression(s);
+
+                // Y coordinate in Y, X coordinate in A.
+                c = g_c;
+                c[0] = I_TAY;
+                c[1] = I_PLA;
+                g_c = c + 2;
+                add_call(plot_fast);
+            }
+        } else {
+            error = 1;
+        }
+
+        // Now we're at the end of our statement.
+        if (!error) {
+            if (continue_statement) {
+                // No problem, just continue from here.
+                done = 0;
+            } else if (*s == ':') {
+                // Skip colon.
+                s += 1;
+
+                // Next statement.
+                done = 0;
+            } else if (*s != '\0') {
+                // Junk at the end of the statement.
+                error = 1;
+            }
+        }
+
+        if (error) {
+            end_of_line_count = 0;
+            compile_load_ax(line_number);
+            add_call(syntax_error);
+
+            // Terminate program.
+            add_abort();
+        }
+    } while (!done);
+
+    // Fill in the places where we needed the address of the end of the line.
+    while (end_of_line_count > 0) {
+        c = end_of_line_address[--end_of_line_count];
+        c[0] = ADDRESS(g_c) & 0xFF;
+        c[1] = ADDRESS(g_c) >> 8;
+    }
+}
+
+
+/**
+ * Complete the compilation buffer.
+ */
+static void complete_compile(void) {
+    int i;
+
+    // Return from function.
+    add_return();
+
+    // Forward GOTOs that couldn't be resolved are changed to
+    // jumps to error messages.
+    for (i = 0; i < g_forward_goto_count; i++) {
+        ForwardGoto *f = &g_forward_goto[i];
+        uint16_t addr = ADDRESS(g_c);
+
+        // Jump to end of buffer.
+        *f->address_low = addr & 0xFF;
+        *f->address_high = addr >> 8;
+
+        // Add code at end of buffer to show error.
+        compile_load_ax(f->source_line_number);
+        add_call(undefined_statement_error);
+
+        // Terminate program.
+        add_abort();
+    }
+}
+
+/**
+ * Clear out all variables. This does not clear their value, only our
+ * knowledge of them.
+ */
+void clear_variables(void) {
+    memset(g_variables, 0, sizeof(g_variables));
+}
+
+/**
+ * Give the variables of the stored program their zero page slots in the
+ * order they first appear in the text, so that machine language routines
+ * can find them. The passes that follow would otherwise allocate them in
+ * the order they happen to look at them.
+ */
+static void allocate_variables(void) {
+    uint8_t *line = g_program;
+    uint8_t *next_line;
+
+    while ((next_line = get_next_line(line)) != 0) {
+        uint8_t *s = line + LINE_TEXT_OFFSET;
+
+        while (*s != '\0' && *s != T_REM) {
+            // Skips the name if the variable was found or created.
+            if (!IS_FIRST_VARIABLE_LETTER(*s) || find_variable(&s) == 0) {
+                s += 1;
+            }
+        }
+
+        line = next_line;
+    }
+}
+
+/**
+ * Compile the stored program.
+ */
+void compile_stored_program(void) {
+    uint8_t *line = g_program;
+    uint8_t *next_line;
+
+    // Clear out all variables.
+    clear_variables();
+
+    set_up_compile();
+    allocate_variables();
+    layout_data();
+    analyze_ranges();
+    layout_arrays();
+
+    // Start reading at the first DATA item.
+    compile_restore();
+
+    // Clear runtime state.
+    add_call(initialize_runtime);
+
+    if (g_static_array_words != 0) {
+        // Allocate the arrays with fixed addresses.
+        compile_load_ax(g_static_array_words);
+        g_c[0] = I_STA_ABS;
+        g_c[1] = ADDRESS(&g_arrays_size) & 0xFF;
+        g_c[2] = ADDRESS(&g_arrays_size) >> 8;
+        g_c[3] = I_STX_ABS;
+        g_c[4] = (ADDRESS(&g_arrays_size) + 1) & 0xFF;
+        g_c[5] = (ADDRESS(&g_arrays_size) + 1) >> 8;
+        g_c += 6;
+    }
+
+    while ((next_line = get_next_line(line)) != 0) {
+        uint16_t line_number = get_line_number(line);
+        add_line_info(line_number, g_c);
+
+        // Compile just this line.
+        compile_buffer(line + LINE_TEXT_OFFSET, line_number);
+
+        line = next_line;
+    }
+
+    complete_compile();
+}
+
+/**
+ * Compile a tokenized line of immediate mode.
+ */
+void compile_immediate(uint8_t *buffer) {
+    set_up_compile();
+    compile_buffer(buffer, INVALID_LINE_NUMBER);
+    complete_compile();
+}
+
+/**
+ * Add the tokenized line to the stored program, replacing the line with the
+ * same number if any. An empty line deletes it.
+ */
+void store_line(uint16_t line_number, uint8_t *buffer) {
+    // Return line to replace or delete, or location to insert new line.
+    uint8_t *line = find_line(line_number);
+    uint8_t *next_line = get_next_line(line);
+    uint8_t *end_of_program = get_end_of_program(line);
+    int16_t adjustment = 0;
+
+    if (next_line == 0 || get_line_number(line) != line_number) {
+        // Didn't find line. Insert it here.
+
+        // Next pointer, line number, line, and nul.
+        uint8_t buffer_length = strlen((char *) buffer);
+        adjustment = LINE_TEXT_OFFSET + buffer_length + 1;
+
+        // Shift rest of program over.
+        memmove(line + adjustment, line, end_of_program - line);
+
+        // Next line. Point to yourself initially, we'll adjust below.
+        *((uint8_t **) line) = line;
+
+        // Line number.
+        *((uint16_t *) (line + LINE_NUMBER_OFFSET)) = line_number;
+
+        // Buffer and nul.
+        memmove(line + LINE_TEXT_OFFSET, buffer, buffer_length + 1);
+    } else {
+        // Found line.
+
+        if (buffer[0] == '\0') {
+            // Empty line, delete old one.
+
+            // Adjustment is negative.
+            adjustment = line - next_line;
+            memmove(line, next_line, end_of_program - next_line);
+        } else {
+            // Replace line.
+
+            // Compute adjustment.
+            uint8_t buffer_length = strlen((char *) buffer);
+            adjustment = line - next_line + LINE_TEXT_OFFSET + buffer_length + 1;
+            memmove(next_line + adjustment, next_line, end_of_program - next_line);
+
+            // Buffer and nul.
+            memmove(line + LINE_TEXT_OFFSET, buffer, buffer_length + 1);
+        }
+    }
+
+    if (adjustment != 0) {
+        // Adjust all the next pointers.
+        while ((next_line = get_next_line(line)) != 0) {
+            // Adjust by the amount we inserted or deleted.
+            next_line += adjustment;
+
+            *((uint8_t **) line) = next_line;
+            line = next_line;
+        }
+    }
+}
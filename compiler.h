@@ -0,0 +1,109 @@
+#ifndef __COMPILER_H__
+#define __COMPILER_H__
+
+#include "platform.h"
+
+// The BASIC compiler: the tokenizer, the stored program, and the code
+// generator that compiles it to 6502 code in g_compiled. It does no screen
+// or keyboard I/O of its own, so it also builds on the host. See host.c.
+
+// Tokens.
+#define T_HOME 0x80
+#define T_PRINT 0x81
+#define T_LIST 0x82
+#define T_POKE 0x83
+#define T_RUN 0x84
+#define T_NEW 0x85
+#define T_PLUS 0x86
+#define T_MINUS 0x87
+#define T_ASTERISK 0x88
+#define T_SLASH 0x89
+#define T_CARET 0x8A
+#define T_AND 0x8B
+#define T_OR 0x8C
+#define T_GREATER_THAN 0x8D
+#define T_EQUAL 0x8E
+#define T_LESS_THAN 0x8F
+#define T_GOTO 0x90
+#define T_IF 0x91
+#define T_THEN 0x92
+#define T_GR 0x93
+#define T_TEXT 0x94
+#define T_COLOR 0x95
+#define T_PLOT 0x96
+#define T_FOR 0x97
+#define T_TO 0x98
+#define T_STEP 0x99
+#define T_NEXT 0x9A
+#define T_NOT 0x9B
+#define T_DIM 0x9C
+#define T_REM 0x9D
+#define T_CHECK 0x9E
+#define T_DATA 0x9F
+#define T_READ 0xA0
+#define T_RESTORE 0xA1
+#define T_GOSUB 0xA2
+#define T_RETURN 0xA3
+#define T_POP 0xA4
+#define T_ON 0xA5
+#define T_MOD 0xA6
+#define T_ABS 0xA7
+#define T_SGN 0xA8
+#define T_SQR 0xA9
+#define T_PEEK 0xAA
+#define T_CALL 0xAB
+#define T_FILL 0xAC
+#define T_MOVE 0xAD
+#define T_DRAW 0xAE
+#define T_SCRN 0xAF
+#define T_RND 0xB0
+#define T_GET 0xB1
+#define T_KEY 0xB2
+
+// Maximum number of lines in stored program.
+#define MAX_LINES 56
+
+// Size of the compiled binary buffer.
+#define COMPILED_SIZE (1024*10)
+
+// Offsets of the line number and tokenized text in a line of the stored
+// program, after the pointer to the next line.
+#define LINE_NUMBER_OFFSET sizeof(uint8_t *)
+#define LINE_TEXT_OFFSET (LINE_NUMBER_OFFSET + 2)
+
+// Info for each compiled line.
+typedef struct {
+    // The line's number.
+    uint16_t line_number;
+
+    // The address in memory where its code was compiled.
+    uint8_t *code;
+} LineInfo;
+
+extern uint8_t g_compiled[COMPILED_SIZE];
+extern uint8_t *g_c;
+extern LineInfo g_line_info[MAX_LINES];
+extern uint8_t g_line_info_count;
+extern uint8_t g_check_bounds;
+
+// Tokenize the line in place. Returns its line number, or
+// INVALID_LINE_NUMBER for immediate mode.
+uint16_t tokenize(uint8_t *s);
+
+// Add a tokenized line to the stored program, replacing or deleting the
+// line with the same number.
+void store_line(uint16_t line_number, uint8_t *buffer);
+
+// Clear the stored program.
+void new_statement(void);
+
+// Clear our knowledge of the variables.
+void clear_variables(void);
+
+// Compile the stored program into g_compiled, from its start to g_c.
+void compile_stored_program(void);
+
+// Compile a tokenized line of immediate mode into g_compiled.
+void compile_immediate(uint8_t *buffer);
+
+#endif // __COMPILER_H__
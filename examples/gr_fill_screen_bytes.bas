@@ -0,0 +1,7 @@
+10 GR
+15 COLOR=5
+20 FOR Y@ = 0 TO 39
+30 FOR X@ = 0 TO 39
+40 PLOT X@,Y@
+50 NEXT X@
+60 NEXT Y@
@@ -0,0 +1,13 @@
+10 DIM G@(39,39)
+20 FOR Y@ = 0 TO 39
+30 FOR X@ = 0 TO 39
+40 G@(Y@,X@) = X@ + Y@
+50 NEXT X@
+60 NEXT Y@
+70 GR
+80 FOR Y@ = 0 TO 39
+90 FOR X@ = 0 TO 39
+100 COLOR= G@(Y@,X@)
+110 PLOT X@,Y@
+120 NEXT X@
+130 NEXT Y@
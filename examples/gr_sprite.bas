@@ -0,0 +1,18 @@
+10 DIM S@(7,7)
+20 FOR R@ = 0 TO 7
+30 FOR C@ = 0 TO 7
+40 READ S@(R@,C@)
+50 NEXT C@
+60 NEXT R@
+70 GR
+80 FOR X = 0 TO 32
+90 DRAW S@(),X,X,0
+100 NEXT X
+110 DATA 0,0,13,13,13,13,0,0
+120 DATA 0,13,13,13,13,13,13,0
+130 DATA 13,13,0,13,13,0,13,13
+140 DATA 13,13,13,13,13,13,13,13
+150 DATA 13,13,13,13,13,13,13,13
+160 DATA 13,0,13,13,13,13,0,13
+170 DATA 0,13,0,0,0,0,13,0
+180 DATA 0,0,13,13,13,13,0,0
@@ -0,0 +1,31 @@
+5 GR
+30 XR = 40
+40 YR = 40
+50 MC = 15
+60 RN! = -2.0
+70 RX! = 1.0
+80 IN! = -1.25
+90 IX! = 1.25
+100 RD! = (RX! - RN!)/(XR - 1)
+110 ID! = (IX! - IN!)/(YR - 1)
+120 I! = IN!
+130 FOR Y = 0 TO YR - 1
+140     R! = RN!
+150     FOR X = 0 TO XR - 1
+160         ZR! = 0
+170         ZI! = 0
+180         CT = 0
+190         R2! = 0
+200         I2! = 0
+220             TR! = R2! - I2! + R!
+230             ZI! = 2*ZR!*ZI! + I!
+240             ZR! = TR!
+260             R2! = ZR!*ZR!
+270             I2! = ZI!*ZI!
+280             CT = CT + 1
+290         IF CT < MC AND R2! + I2! < 4 GOTO 220
+300         COLOR=15-CT:PLOT X,Y
+310         R! = R! + RD!
+320     NEXT X
+340     I! = I! + ID!
+350 NEXT Y
@@ -1,46 +1,19 @@
 10 GR
 20 TS = 40
 30 DIM DX(9),DY(9),C(9),X(9),Y(9),T(9)
-1000 DX(0) = -1
-1005 DY(0) = -19
-1010 C(0) = 1
-1015 T(0) = 26
-1100 DX(1) = -14
-1105 DY(1) = -13
-1110 C(1) = 5
-1115 T(1) = 23
-1200 DX(2) = 12
-1205 DY(2) = -15
-1210 C(2) = 7
-1215 T(2) = 3
-1300 DX(3) = 19
-1305 DY(3) = 2
-1310 C(3) = 9
-1315 T(3) = 10
-1400 DX(4) = 17
-1405 DY(4) = -10
-1410 C(4) = 12
-1415 T(4) = 4
-1500 DX(5) = 17
-1505 DY(5) = -9
-1510 C(5) = 9
-1515 T(5) = 5
-1600 DX(6) = 15
-1605 DY(6) = 12
-1610 C(6) = 4
-1615 T(6) = 22
-1700 DX(7) = -18
-1705 DY(7) = -8
-1710 C(7) = 5
-1715 T(7) = 23
-1800 DX(8) = -2
-1805 DY(8) = -19
-1810 C(8) = 1
-1815 T(8) = 29
-1900 DX(9) = -7
-1905 DY(9) = 18
-1910 C(9) = 10
-1915 T(9) = 28
+40 FOR I = 0 TO 9
+50 READ DX(I),DY(I),C(I),T(I)
+60 NEXT I
+1000 DATA -1,-19,1,26
+1100 DATA -14,-13,5,23
+1200 DATA 12,-15,7,3
+1300 DATA 19,2,9,10
+1400 DATA 17,-10,12,4
+1500 DATA 17,-9,9,5
+1600 DATA 15,12,4,22
+1700 DATA -18,-8,5,23
+1800 DATA -2,-19,1,29
+1900 DATA -7,18,10,28
 2200 I = 0
 2210 OX = X(I) : OY = Y(I)
 2220 X(I) = 20 + DX(I) * T(I) / 40
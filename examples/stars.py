@@ -1,10 +1,7 @@
 import random
 import math
 
-str = """%(init)d00 DX(%(which)d) = %(x)d
-%(init)d05 DY(%(which)d) = %(y)d
-%(init)d10 C(%(which)d) = %(c)d
-%(init)d15 T(%(which)d) = %(t)d"""
+str = """%(init)d00 DATA %(x)d,%(y)d,%(c)d,%(t)d"""
 
 num_stars = 10
 ts = 40
@@ -12,6 +9,9 @@ ts = 40
 print "10 GR"
 print "20 TS = %d" % ts
 print "30 DIM DX(%(n)d),DY(%(n)d),C(%(n)d),X(%(n)d),Y(%(n)d),T(%(n)d)" % {'n' : num_stars - 1 }
+print "40 FOR I = 0 TO %d" % (num_stars - 1)
+print "50 READ DX(I),DY(I),C(I),T(I)"
+print "60 NEXT I"
 
 for i in range(0,num_stars) :
     angle = random.uniform(0,.999)
@@ -19,7 +19,7 @@ for i in range(0,num_stars) :
     y = int(20 * math.sin(angle * 3.14159 * 2))
     c = random.randrange(1,15)
     t = random.randrange(0,ts - 1)
-    print str % {'init' : 10 + i, 'x' : x, 'y' : y, 'c' : c, 'which' : i, 't' : t}
+    print str % {'init' : 10 + i, 'x' : x, 'y' : y, 'c' : c, 't' : t}
 
 print "2200 I = 0"
 print "2210 OX = X(I) : OY = Y(I)"
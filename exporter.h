@@ -20,18 +20,23 @@ extern void bnegax();
 extern void negax();
 extern void aslax1();
 extern void ldaxi();
+extern void ldaui();
 extern void staxspidx();
+extern void staspidx();
 
 // Two bytes each.
 extern unsigned int sp;
-#pragma zpsym ("sp");
 extern unsigned int ptr1;
-#pragma zpsym ("ptr1");
 
 // One byte each.
 extern unsigned char tmp1;
-#pragma zpsym ("tmp1");
 extern unsigned char tmp2;
+
+#ifndef HOST
+#pragma zpsym ("sp");
+#pragma zpsym ("ptr1");
+#pragma zpsym ("tmp1");
 #pragma zpsym ("tmp2");
+#endif
 
 #endif // __EXPORTER_H__
@@ -39,8 +39,12 @@
 .export     _aslax1 := aslax1
 .import     ldaxi
 .export     _ldaxi := ldaxi
+.import     ldaui
+.export     _ldaui := ldaui
 .import     staxspidx
 .export     _staxspidx := staxspidx
+.import     staspidx
+.export     _staspidx := staspidx
 
 .importzp   sp
 .exportzp   _sp = sp
@@ -0,0 +1,419 @@
+// Command-line build of the compiler for the host, for testing and for
+// measuring the generated code without an emulator. Compiles a .bas file
+// and writes the 6502 code, the address and size of each line's code, and
+// the total size. Run "make host" to build it.
+//
+// The compiled code refers to runtime routines, zero-page variables, and
+// buffers by their address in the ROM. Those come from the map that ld65
+// writes when building the ROM (main.map), so that the bytes are the same
+// as on the 6502. Without a map the zero page is still right, but the
+// other addresses are 0.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "exporter.h"
+#include "math.h"
+#include "platform.h"
+#include "runtime.h"
+#include "screen.h"
+#include "statements.h"
+
+// Longest line in a .bas file.
+#define MAX_SOURCE_LINE 256
+
+// Number of rows of the text screen. Must match runtime.c.
+#define SCREEN_HEIGHT 24
+
+// Symbol of the ROM whose address goes into compiled code.
+typedef struct {
+    // Name in the ld65 map.
+    char *name;
+
+    // Object or routine on the host, and the size of the object (1 for a
+    // routine). Pointers into it are offsets from its 6502 address.
+    void *host;
+    uint16_t size;
+
+    // Address on the 6502.
+    uint16_t address;
+} Symbol;
+
+// The runtime, which is 6502 code or touches the screen, isn't built here.
+// These stand in for it so that the compiler has something to take the
+// address of. The ones it calls while compiling print to stderr.
+void pushax() {}
+void popax() {}
+void incsp2() {}
+void tosaddax() {}
+void tossubax() {}
+void tosmulax() {}
+void tosdivax() {}
+void toseqax() {}
+void tosneax() {}
+void tosltax() {}
+void tosgtax() {}
+void tosleax() {}
+void tosgeax() {}
+void bnegax() {}
+void negax() {}
+void aslax1() {}
+void ldaxi() {}
+void ldaui() {}
+void staxspidx() {}
+void staspidx() {}
+unsigned int sp;
+unsigned int ptr1;
+unsigned char tmp1;
+unsigned char tmp2;
+
+void mul16() {}
+void mul16x8() {}
+void mulfix() {}
+void pow16() {}
+void powfix() {}
+void div16() {}
+void mod16() {}
+void sqrt16() {}
+void rnd_next() {}
+void rnd16() {}
+
+uint8_t text_row_lo[SCREEN_HEIGHT];
+uint8_t text_row_hi[SCREEN_HEIGHT];
+void color_fast() {}
+void plot_fast() {}
+void draw_fast() {}
+
+void for_fast() {}
+void next_fast() {}
+void allocate_array_fast() {}
+void allocate_byte_array_fast() {}
+void call_ax() {}
+void fill_memory() {}
+void fill_word_memory() {}
+void move_memory() {}
+void print_int_fast() {}
+void enter_program() {}
+void abort_program() {}
+void bad_subscript_error_fast() {}
+void out_of_data_error_fast() {}
+void out_of_memory_error_fast() {}
+void return_without_gosub_error_fast() {}
+uint8_t program_stack;
+
+VarInfo g_variables[MAX_VARIABLES];
+uint16_t g_arrays[MAX_ARRAY_WORDS];
+uint16_t g_arrays_size;
+uint16_t g_array_limits[MAX_VARIABLES];
+
+void initialize_runtime(void) {}
+void home(void) {}
+void gr_statement(void) {}
+void text_statement(void) {}
+void syntax_error(uint16_t line_number) {}
+void redimd_array_error(uint16_t line_number) {}
+void undefined_statement_error(uint16_t line_number) {}
+void print_fixed(int16_t f) {}
+int16_t div_fixed(int16_t a, int16_t b) { return 0; }
+
+void print(uint8_t *s) {
+    fputs((char *) s, stderr);
+}
+
+void print_char(uint8_t c) {
+    fputc(c, stderr);
+}
+
+void print_uint(uint16_t i) {
+    fprintf(stderr, "%u", i);
+}
+
+void print_newline(void) {
+    fputc('\n', stderr);
+}
+
+#define ROUTINE(name, map_name, address) { map_name, (void *) name, 1, address }
+#define OBJECT(name, map_name, address) { map_name, (void *) &name, sizeof(name), address }
+
+static Symbol g_symbols[] = {
+    // cc65 runtime. Its zero page is always in the same place.
+    ROUTINE(pushax, "pushax", 0),
+    ROUTINE(popax, "popax", 0),
+    ROUTINE(incsp2, "incsp2", 0),
+    ROUTINE(tosaddax, "tosaddax", 0),
+    ROUTINE(tossubax, "tossubax", 0),
+    ROUTINE(tosmulax, "tosmulax", 0),
+    ROUTINE(tosdivax, "tosdivax", 0),
+    ROUTINE(toseqax, "toseqax", 0),
+    ROUTINE(tosneax, "tosneax", 0),
+    ROUTINE(tosltax, "tosltax", 0),
+    ROUTINE(tosgtax, "tosgtax", 0),
+    ROUTINE(tosleax, "tosleax", 0),
+    ROUTINE(tosgeax, "tosgeax", 0),
+    ROUTINE(bnegax, "bnegax", 0),
+    ROUTINE(negax, "negax", 0),
+    ROUTINE(aslax1, "aslax1", 0),
+    ROUTINE(ldaxi, "ldaxi", 0),
+    ROUTINE(ldaui, "ldaui", 0),
+    ROUTINE(staxspidx, "staxspidx", 0),
+    ROUTINE(staspidx, "staspidx", 0),
+    OBJECT(sp, "sp", 0x00),
+    OBJECT(ptr1, "ptr1", 0x08),
+    OBJECT(tmp1, "tmp1", 0x10),
+    OBJECT(tmp2, "tmp2", 0x11),
+
+    // math.s.
+    ROUTINE(mul16, "_mul16", 0),
+    ROUTINE(mul16x8, "_mul16x8", 0),
+    ROUTINE(mulfix, "_mulfix", 0),
+    ROUTINE(pow16, "_pow16", 0),
+    ROUTINE(powfix, "_powfix", 0),
+    ROUTINE(div16, "_div16", 0),
+    ROUTINE(mod16, "_mod16", 0),
+    ROUTINE(sqrt16, "_sqrt16", 0),
+    ROUTINE(rnd_next, "_rnd_next", 0),
+    ROUTINE(rnd16, "_rnd16", 0),
+
+    // screen.s.
+    OBJECT(text_row_lo, "_text_row_lo", 0),
+    OBJECT(text_row_hi, "_text_row_hi", 0),
+    ROUTINE(color_fast, "_color_fast", 0),
+    ROUTINE(plot_fast, "_plot_fast", 0),
+    ROUTINE(draw_fast, "_draw_fast", 0),
+
+    // statements.s.
+    ROUTINE(for_fast, "_for_fast", 0),
+    ROUTINE(next_fast, "_next_fast", 0),
+    ROUTINE(allocate_array_fast, "_allocate_array_fast", 0),
+    ROUTINE(allocate_byte_array_fast, "_allocate_byte_array_fast", 0),
+    ROUTINE(call_ax, "_call_ax", 0),
+    ROUTINE(fill_memory, "_fill_memory", 0),
+    ROUTINE(fill_word_memory, "_fill_word_memory", 0),
+    ROUTINE(move_memory, "_move_memory", 0),
+    ROUTINE(print_int_fast, "_print_int_fast", 0),
+    ROUTINE(enter_program, "_enter_program", 0),
+    ROUTINE(abort_program, "_abort_program", 0),
+    ROUTINE(bad_subscript_error_fast, "_bad_subscript_error_fast", 0),
+    ROUTINE(out_of_data_error_fast, "_out_of_data_error_fast", 0),
+    ROUTINE(out_of_memory_error_fast, "_out_of_memory_error_fast", 0),
+    ROUTINE(return_without_gosub_error_fast, "_return_without_gosub_error_fast", 0),
+    OBJECT(program_stack, "_program_stack", 0),
+
+    // runtime.c.
+    OBJECT(g_arrays, "_g_arrays", 0),
+    OBJECT(g_arrays_size, "_g_arrays_size", 0),
+    OBJECT(g_array_limits, "_g_array_limits", 0),
+    ROUTINE(initialize_runtime, "_initialize_runtime", 0),
+    ROUTINE(home, "_home", 0),
+    ROUTINE(gr_statement, "_gr_statement", 0),
+    ROUTINE(text_statement, "_text_statement", 0),
+    ROUTINE(syntax_error, "_syntax_error", 0),
+    ROUTINE(redimd_array_error, "_redimd_array_error", 0),
+    ROUTINE(undefined_statement_error, "_undefined_statement_error", 0),
+    ROUTINE(print, "_print", 0),
+    ROUTINE(print_char, "_print_char", 0),
+    ROUTINE(print_uint, "_print_uint", 0),
+    ROUTINE(print_fixed, "_print_fixed", 0),
+    ROUTINE(print_newline, "_print_newline", 0),
+    ROUTINE(div_fixed, "_div_fixed", 0),
+
+    // compiler.c. The compiled code, including the DATA table.
+    OBJECT(g_compiled, "_g_compiled", 0),
+};
+static int g_symbol_count = sizeof(g_symbols)/sizeof(g_symbols[0]);
+
+/**
+ * Return the 6502 address of a pointer to a symbol, or into one.
+ */
+uint16_t host_address(void *p) {
+    uint8_t *q = p;
+    int i;
+
+    // A dynamic array has no fixed address, which the compiler checks for
+    // as zero.
+    if (q == NULL) {
+        return 0;
+    }
+
+    for (i = 0; i < g_symbol_count; i++) {
+        Symbol *symbol = &g_symbols[i];
+        uint8_t *host = symbol->host;
+
+        // Allow one past the end, like the end of the compiled code.
+        if (q >= host && q <= host + symbol->size) {
+            return symbol->address + (q - host);
+        }
+    }
+
+    fprintf(stderr, "No 6502 address for %p\n", p);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Set the address of each symbol from the "Exports list by name" of an
+ * ld65 map. Returns whether successful.
+ */
+static int read_map(char *pathname) {
+    FILE *f = fopen(pathname, "r");
+    char line[MAX_SOURCE_LINE];
+    char name[2][64];
+    unsigned int address[2];
+    int in_exports = 0;
+    int found = 0;
+    int count;
+    int i, j;
+
+    if (f == NULL) {
+        perror(pathname);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "Exports list by name:", 21) == 0) {
+            in_exports = 1;
+        } else if (in_exports && line[0] == '\n') {
+            break;
+        } else if (in_exports && line[0] != '-') {
+            // Two exports per line: name, address, and flags.
+            count = sscanf(line, "%63s %x %*s %63s %x",
+                    name[0], &address[0], name[1], &address[1]);
+            for (j = 0; j < count/2; j++) {
+                for (i = 0; i < g_symbol_count; i++) {
+                    if (strcmp(name[j], g_symbols[i].name) == 0) {
+                        g_symbols[i].address = address[j];
+                        found += 1;
+                    }
+                }
+            }
+        }
+    }
+    fclose(f);
+
+    if (found < g_symbol_count) {
+        fprintf(stderr, "%s: %d of %d symbols not found\n", pathname,
+                g_symbol_count - found, g_symbol_count);
+    }
+
+    return 1;
+}
+
+/**
+ * Read a BASIC program into the stored program. Returns whether successful.
+ */
+static int read_program(char *pathname) {
+    FILE *f = fopen(pathname, "r");
+    uint8_t buffer[MAX_SOURCE_LINE];
+    uint16_t line_number;
+    size_t length;
+
+    if (f == NULL) {
+        perror(pathname);
+        return 0;
+    }
+
+    new_statement();
+    while (fgets((char *) buffer, sizeof(buffer), f) != NULL) {
+        length = strlen((char *) buffer);
+        while (length > 0 && (buffer[length - 1] == '\n' || buffer[length - 1] == '\r')) {
+            buffer[--length] = '\0';
+        }
+        if (length == 0) {
+            continue;
+        }
+
+        line_number = tokenize(buffer);
+        if (line_number == INVALID_LINE_NUMBER) {
+            fprintf(stderr, "%s: line without a number: %s\n", pathname, buffer);
+            fclose(f);
+            return 0;
+        }
+        store_line(line_number, buffer);
+    }
+    fclose(f);
+
+    return 1;
+}
+
+/**
+ * Print the address and size of each compiled line, and the total size.
+ */
+static void print_line_map(void) {
+    uint8_t *end;
+    int i;
+
+    printf("line  address  bytes\n");
+    for (i = 0; i < g_line_info_count; i++) {
+        LineInfo *info = &g_line_info[i];
+
+        end = i + 1 < g_line_info_count ? g_line_info[i + 1].code : g_c;
+        printf("%5u  $%04X  %5u\n", info->line_number, ADDRESS(info->code),
+                (unsigned int) (end - info->code));
+    }
+    printf("total  $%04X  %5u\n", ADDRESS(g_compiled), (unsigned int) (g_c - g_compiled));
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: apple2a-host [-c] [-m main.map] [-o program.bin] program.bas\n"
+            "  -c  compile with array bounds checks, like RUN CHECK\n"
+            "  -m  addresses of the ROM's symbols, from ld65\n"
+            "  -o  write the compiled 6502 code\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    char *map_pathname = NULL;
+    char *output_pathname = NULL;
+    FILE *f;
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-c") == 0) {
+            g_check_bounds = 1;
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            map_pathname = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_pathname = argv[++i];
+        } else {
+            usage();
+        }
+    }
+    if (i != argc - 1) {
+        usage();
+    }
+
+    if (map_pathname != NULL && !read_map(map_pathname)) {
+        return EXIT_FAILURE;
+    }
+
+    // The compiler reads the row tables of screen.s.
+    for (i = 0; i < SCREEN_HEIGHT; i++) {
+        uint16_t address = 0x0400 + (i % 8)*0x80 + (i / 8)*40;
+
+        text_row_lo[i] = address & 0xFF;
+        text_row_hi[i] = address >> 8;
+    }
+
+    if (!read_program(argv[argc - 1])) {
+        return EXIT_FAILURE;
+    }
+    compile_stored_program();
+    if (g_c - g_compiled > COMPILED_SIZE) {
+        fprintf(stderr, "Binary length exceeded\n");
+        return EXIT_FAILURE;
+    }
+
+    if (output_pathname != NULL) {
+        f = fopen(output_pathname, "wb");
+        if (f == NULL || fwrite(g_compiled, 1, g_c - g_compiled, f) != g_c - g_compiled) {
+            perror(output_pathname);
+            return EXIT_FAILURE;
+        }
+        fclose(f);
+    }
+
+    print_line_map();
+
+    return EXIT_SUCCESS;
+}
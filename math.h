@@ -0,0 +1,45 @@
+#ifndef __MATH_H__
+#define __MATH_H__
+
+// Defines the arithmetic routines in math.s. These are called from
+// compiled code and use register calling conventions, so they can't
+// be called from C.
+
+// 16-bit multiply. Left operand on the cc65 stack, right operand in AX,
+// product in AX. Replaces tosmulax.
+extern void mul16();
+
+// Multiply AX by the unsigned byte in Y, product in AX.
+extern void mul16x8();
+
+// Signed 8.8 fixed-point multiply. Left operand on the cc65 stack, right
+// operand in AX, product in AX.
+extern void mulfix();
+
+// Integer base on the cc65 stack raised to the integer power in AX,
+// result in AX. A negative power gives 0.
+extern void pow16();
+
+// Fixed-point base on the cc65 stack raised to the integer power in AX,
+// fixed-point result in AX.
+extern void powfix();
+
+// Signed 16-bit divide, rounding toward zero. Dividend on the cc65 stack,
+// divisor in AX, quotient in AX. Replaces tosdivax.
+extern void div16();
+
+// Remainder of the same divide as div16(), with the sign of the dividend.
+extern void mod16();
+
+// Integer square root of the unsigned word in AX. Root in A, X is zero.
+extern void sqrt16();
+
+// Advance the RND generator. High byte of the new state in A, X and Y
+// unchanged.
+extern void rnd_next();
+
+// RND function. Random number from 0 to AX - 1 in AX. A negative AX seeds
+// the generator instead and gives 0.
+extern void rnd16();
+
+#endif // __MATH_H__
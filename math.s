@@ -0,0 +1,502 @@
+; ---------------------------------------------------------------------------
+; math.s
+; ---------------------------------------------------------------------------
+;
+; Arithmetic routines called from compiled code in place of the generic
+; cc65 runtime. See the companion header file math.h.
+
+.export   _mul16, _mul16x8, _mulfix, _pow16, _powfix
+.export   _div16, _mod16, _sqrt16, _rnd_next, _rnd16
+
+.import   popax
+.importzp ptr2, ptr3, ptr4, tmp1, tmp2, tmp3
+
+; These must match runtime.h.
+RND_SEED  = 91
+
+; Negate the word at "addr".
+.macro    negate16 addr
+          SEC
+          LDA     #0
+          SBC     addr
+          STA     addr
+          LDA     #0
+          SBC     addr+1
+          STA     addr+1
+.endmacro
+
+; Raise the left operand on the cc65 stack to the power of the integer in
+; AX by square-and-multiply, using "multiply" to multiply AX by ptr2 and
+; "one" as the starting product. A negative power gives 0.
+.macro    power multiply, one
+          STA     pow_exp
+          STX     pow_exp+1
+          JSR     popax
+          STA     pow_base
+          STX     pow_base+1
+          LDA     #<(one)
+          STA     pow_result
+          LDA     #>(one)
+          STA     pow_result+1
+          LDA     pow_exp+1
+          BPL     @loop
+          LDA     #0
+          TAX
+          RTS
+
+          ; Multiply the product by the base for each one bit of the power,
+          ; squaring the base for the next bit.
+@loop:    LSR     pow_exp+1
+          ROR     pow_exp
+          BCC     @square
+          LDA     pow_base
+          STA     ptr2
+          LDA     pow_base+1
+          STA     ptr2+1
+          LDA     pow_result
+          LDX     pow_result+1
+          JSR     multiply
+          STA     pow_result
+          STX     pow_result+1
+@square:  LDA     pow_exp
+          ORA     pow_exp+1
+          BEQ     @done
+          LDA     pow_base
+          STA     ptr2
+          LDX     pow_base+1
+          STX     ptr2+1
+          JSR     multiply
+          STA     pow_base
+          STX     pow_base+1
+          JMP     @loop
+
+@done:    LDA     pow_result
+          LDX     pow_result+1
+          RTS
+.endmacro
+
+.segment  "BSS"
+
+pow_base:       .res 2
+pow_result:     .res 2
+pow_exp:        .res 2
+
+; ---------------------------------------------------------------------------
+; Quarter-square tables: f(n) = n*n/4 for n = 0 to 511. These are in their
+; own segment at the start of ROM so that they're page-aligned and their
+; size shows up separately in the ROM usage report.
+
+.segment  "MULTABLES"
+
+sqr_lo:
+          .repeat 512, I
+          .byte   <((I*I)/4)
+          .endrep
+sqr_hi:
+          .repeat 512, I
+          .byte   >((I*I)/4)
+          .endrep
+
+.segment  "CODE"
+
+; ---------------------------------------------------------------------------
+; Unsigned 8x8 multiply of A by Y. Returns the 16-bit product with the low
+; byte in A and the high byte in X. Uses a*b = f(a+b) - f(|a-b|), which is
+; exact because a+b and a-b have the same parity.
+
+mul8x8:
+          STA     tmp1
+          STY     tmp2
+
+          ; |a - b| in X.
+          SEC
+          SBC     tmp2
+          BCS     @positive
+          EOR     #$FF
+          ADC     #1              ; Carry is clear.
+@positive:
+          TAX
+
+          ; a + b in Y, with the ninth bit in carry.
+          CLC
+          LDA     tmp1
+          ADC     tmp2
+          TAY
+          BCS     @high_sum
+
+          SEC
+          LDA     sqr_lo,Y
+          SBC     sqr_lo,X
+          STA     tmp1
+          LDA     sqr_hi,Y
+          SBC     sqr_hi,X
+          TAX
+          LDA     tmp1
+          RTS
+
+@high_sum:
+          SEC
+          LDA     sqr_lo+256,Y
+          SBC     sqr_lo,X
+          STA     tmp1
+          LDA     sqr_hi+256,Y
+          SBC     sqr_hi,X
+          TAX
+          LDA     tmp1
+          RTS
+
+; ---------------------------------------------------------------------------
+; 16-bit multiply, a drop-in replacement for tosmulax: the left operand is
+; on the cc65 stack and the right operand in AX. Returns the low 16 bits of
+; the product in AX, which is the same for signed and unsigned operands.
+; Partial products of zero high bytes are skipped.
+
+_mul16:
+          STA     ptr2
+          STX     ptr2+1
+          JSR     popax
+
+          ; Multiply AX by ptr2.
+mul_ptr2:
+          LDY     ptr2+1
+          BNE     @full
+          LDY     ptr2
+          JMP     _mul16x8
+
+          ; Right operand doesn't fit in a byte: a*b = al*bl + (ah*bl + al*bh) << 8.
+@full:    STA     ptr3
+          STX     ptr3+1
+          LDY     ptr2
+          JSR     mul8x8
+          STA     ptr4
+          STX     ptr4+1
+          LDA     ptr3+1
+          BEQ     @low_left
+          LDY     ptr2
+          JSR     mul8x8
+          CLC
+          ADC     ptr4+1
+          STA     ptr4+1
+@low_left:
+          LDA     ptr3
+          LDY     ptr2+1
+          JSR     mul8x8
+          CLC
+          ADC     ptr4+1
+          TAX
+          LDA     ptr4
+          RTS
+
+; ---------------------------------------------------------------------------
+; Multiply AX by the unsigned byte in Y. Returns the low 16 bits of the
+; product in AX. The compiler calls this directly when it knows the right
+; operand fits in a byte, so nothing goes through the cc65 stack.
+
+_mul16x8:
+          STA     ptr3
+          STX     ptr3+1
+          STY     ptr2
+          JSR     mul8x8
+          STA     ptr4
+          STX     ptr4+1
+          LDA     ptr3+1
+          BEQ     @done
+          LDY     ptr2
+          JSR     mul8x8
+          CLC
+          ADC     ptr4+1
+          STA     ptr4+1
+@done:    LDA     ptr4
+          LDX     ptr4+1
+          RTS
+
+; ---------------------------------------------------------------------------
+; Signed 8.8 fixed-point multiply. Left operand on the cc65 stack, right
+; operand in AX. Multiplies the magnitudes 16x16 to 32 bits and keeps the
+; middle two bytes, so there's no shift or division. Returns the product
+; in AX, rounded toward zero.
+
+_mulfix:
+          STA     ptr2
+          STX     ptr2+1
+          JSR     popax
+
+          ; Multiply AX by ptr2.
+mulfix_ptr2:
+          STA     ptr3
+          STX     ptr3+1
+
+          ; Sign of the product.
+          TXA
+          EOR     ptr2+1
+          STA     tmp3
+
+          ; Magnitudes.
+          LDA     ptr3+1
+          BPL     @left_positive
+          negate16 ptr3
+@left_positive:
+          LDA     ptr2+1
+          BPL     @right_positive
+          negate16 ptr2
+@right_positive:
+
+          ; Bytes 1 and 2 of the product accumulate in ptr4. Byte 0 only
+          ; comes from al*bl, so it can't carry, and byte 3 is dropped.
+          LDA     ptr3
+          LDY     ptr2
+          JSR     mul8x8          ; al*bl
+          STX     ptr4
+          LDA     #0
+          STA     ptr4+1
+
+          LDA     ptr3
+          LDY     ptr2+1
+          JSR     mul8x8          ; al*bh
+          CLC
+          ADC     ptr4
+          STA     ptr4
+          TXA
+          ADC     ptr4+1
+          STA     ptr4+1
+
+          LDA     ptr3+1
+          LDY     ptr2
+          JSR     mul8x8          ; ah*bl
+          CLC
+          ADC     ptr4
+          STA     ptr4
+          TXA
+          ADC     ptr4+1
+          STA     ptr4+1
+
+          LDA     ptr3+1
+          LDY     ptr2+1
+          JSR     mul8x8          ; ah*bh
+          CLC
+          ADC     ptr4+1
+          STA     ptr4+1
+
+          LDA     tmp3
+          BPL     @done
+          negate16 ptr4
+@done:    LDA     ptr4
+          LDX     ptr4+1
+          RTS
+
+; ---------------------------------------------------------------------------
+; Integer power. The base is on the cc65 stack and the power in AX. Returns
+; the low 16 bits of the result in AX.
+
+_pow16:
+          power   mul_ptr2, 1
+
+; ---------------------------------------------------------------------------
+; Fixed-point base on the cc65 stack raised to the integer power in AX.
+
+_powfix:
+          power   mulfix_ptr2, $0100
+
+; ---------------------------------------------------------------------------
+; Signed 16-bit divide with remainder. The dividend is on the cc65 stack and
+; the divisor in AX. Leaves the quotient, rounded toward zero, in ptr3 and
+; the remainder, with the sign of the dividend, in ptr4, so "/" and MOD are
+; the same loop.
+
+divmod16:
+          STA     ptr2
+          STX     ptr2+1
+          JSR     popax
+          STA     ptr3
+          STX     ptr3+1
+
+          ; Signs of the remainder and the quotient.
+          STX     tmp3
+          TXA
+          EOR     ptr2+1
+          STA     tmp2
+
+          ; Magnitudes.
+          LDA     ptr3+1
+          BPL     @dividend_positive
+          negate16 ptr3
+@dividend_positive:
+          LDA     ptr2+1
+          BPL     @divisor_positive
+          negate16 ptr2
+@divisor_positive:
+
+          ; Shift the dividend into the remainder a bit at a time. The
+          ; quotient bits shift into the dividend from the right.
+          LDA     #0
+          STA     ptr4
+          STA     ptr4+1
+          LDY     #16
+@loop:    ASL     ptr3
+          ROL     ptr3+1
+          ROL     ptr4
+          ROL     ptr4+1
+          SEC
+          LDA     ptr4
+          SBC     ptr2
+          TAX
+          LDA     ptr4+1
+          SBC     ptr2+1
+          BCC     @next
+          STA     ptr4+1
+          STX     ptr4
+          INC     ptr3            ; Low bit is clear from the shift.
+@next:    DEY
+          BNE     @loop
+
+          LDA     tmp2
+          BPL     @quotient_positive
+          negate16 ptr3
+@quotient_positive:
+          LDA     tmp3
+          BPL     @done
+          negate16 ptr4
+@done:    RTS
+
+; ---------------------------------------------------------------------------
+; "/" operator, a drop-in replacement for tosdivax. Dividend on the cc65
+; stack, divisor in AX, quotient in AX.
+
+_div16:
+          JSR     divmod16
+          LDA     ptr3
+          LDX     ptr3+1
+          RTS
+
+; ---------------------------------------------------------------------------
+; MOD operator. Same arguments as _div16, remainder in AX.
+
+_mod16:
+          JSR     divmod16
+          LDA     ptr4
+          LDX     ptr4+1
+          RTS
+
+; ---------------------------------------------------------------------------
+; Integer square root of the unsigned word in AX, rounded down. Returns the
+; root in A with X zero. Brings in two bits of the number at a time and
+; finds one bit of the root each step.
+
+_sqrt16:
+          STA     ptr2
+          STX     ptr2+1
+          LDA     #0
+          STA     ptr3            ; Remainder.
+          STA     ptr3+1
+          STA     tmp1            ; Root.
+          LDY     #8
+@loop:
+          .repeat 2
+          ASL     ptr2
+          ROL     ptr2+1
+          ROL     ptr3
+          ROL     ptr3+1
+          .endrep
+
+          ; Try subtracting root*4 + 1 from the remainder. Clearing the
+          ; carry subtracts the extra one.
+          LDA     tmp1
+          STA     ptr4
+          LDA     #0
+          STA     ptr4+1
+          ASL     ptr4
+          ROL     ptr4+1
+          ASL     ptr4
+          ROL     ptr4+1
+          CLC
+          LDA     ptr3
+          SBC     ptr4
+          TAX
+          LDA     ptr3+1
+          SBC     ptr4+1
+          BCC     @zero_bit
+          STA     ptr3+1
+          STX     ptr3
+@zero_bit:
+          ROL     tmp1            ; Carry is the new bit of the root.
+          DEY
+          BNE     @loop
+
+          LDA     tmp1
+          LDX     #0
+          RTS
+
+; ---------------------------------------------------------------------------
+; Advance the RND generator, a 16-bit xorshift with shifts 7, 9, and 8 that
+; goes through every nonzero state. Returns the high byte of the new state
+; in A and leaves X and Y alone.
+
+_rnd_next:
+          LDA     RND_SEED+1
+          LSR     A
+          LDA     RND_SEED
+          ROR     A
+          EOR     RND_SEED+1
+          STA     RND_SEED+1      ; High byte of x ^= x << 7.
+          ROR     A
+          EOR     RND_SEED
+          STA     RND_SEED        ; x ^= x >> 9, and the low byte of x << 7.
+          EOR     RND_SEED+1
+          STA     RND_SEED+1      ; x ^= x << 8.
+          RTS
+
+; ---------------------------------------------------------------------------
+; RND function. For a positive range in AX, returns a random number from 0
+; to one less than the range in AX. The state is masked to the smallest
+; power of two that covers the range and drawn again if it's out of range,
+; so there's no division and fewer than two draws on average. A negative
+; range seeds the generator with it and returns 0, as does a range of 0.
+
+_rnd16:
+          CPX     #$80
+          BCS     @seed
+          STA     ptr2
+          STX     ptr2+1
+          ORA     ptr2+1
+          BEQ     @done           ; AX is zero.
+
+          ; Range minus one in ptr3.
+          SEC
+          LDA     ptr2
+          SBC     #1
+          STA     ptr3
+          LDA     ptr2+1
+          SBC     #0
+          STA     ptr3+1
+
+          ; Mask in ptr4, with ones shifted in until it covers ptr3.
+          LDA     #0
+          STA     ptr4
+          STA     ptr4+1
+@mask:    LDA     ptr4
+          CMP     ptr3
+          LDA     ptr4+1
+          SBC     ptr3+1
+          BCS     @draw
+          SEC
+          ROL     ptr4
+          ROL     ptr4+1
+          JMP     @mask
+
+@draw:    JSR     _rnd_next
+          AND     ptr4+1
+          TAX
+          LDA     RND_SEED
+          AND     ptr4
+          CPX     ptr2+1
+          BCC     @done
+          BNE     @draw
+          CMP     ptr2
+          BCS     @draw
+@done:    RTS
+
+@seed:    STA     RND_SEED
+          STX     RND_SEED+1
+          LDA     #0
+          TAX
+          RTS
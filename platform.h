@@ -4,11 +4,33 @@
 #define TEXT_PAGE1_BASE ((unsigned char *)0x400)
 #define TEXT_PAGE2_BASE ((unsigned char *)0x800)
 
+#ifdef HOST
+
+// Building the compiler on the host for testing. See host.c.
+#include <stdint.h>
+
+// 6502 address of a pointer, looked up in the ROM's symbols.
+extern uint16_t host_address(void *p);
+#define ADDRESS(p) host_address((void *) (p))
+
+#else
+
 // Standard types.
 typedef signed char int8_t;
 typedef unsigned char uint8_t;
 typedef signed int int16_t;
 typedef unsigned int uint16_t;
+typedef signed long int32_t;
+typedef unsigned long uint32_t;
+
+// 6502 address of a pointer, such as to a runtime routine or to code
+// being compiled.
+#define ADDRESS(p) ((uint16_t) (p))
+
+#endif
+
+// Zero-page address of a variable, such as cc65's ptr1.
+#define ZP_ADDRESS(v) ((uint8_t) ADDRESS(&(v)))
 
 // Returns non-zero if a key is ready to be read.
 extern int keyboard_test(void);
@@ -28,9 +28,12 @@ BEGIN {
 
 /^VECTORS/ { vectors_start = parse_hex($2) }
 
+/^MULTABLES/ { tables = parse_hex($4) }
+
 END {
-    code = rodata_end - code_start + 1
-    all = vectors_start - code_start
+    code = rodata_end - code_start + 1 + tables
+    all = vectors_start - code_start + tables
     printf "%d of %d ROM bytes (%d%%) used\n", code, all, code*100/all
+    printf "%d bytes of multiply tables\n", tables
 }
 
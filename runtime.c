@@ -1,13 +1,11 @@
 
 #include <string.h>
 #include "runtime.h"
+#include "screen.h"
 
 // Max number of nested FOR loops. This value matches AppleSoft BASIC.
 #define MAX_FOR 10
 
-// Max words for arrays.
-#define MAX_ARRAY_WORDS 2048
-
 #define CURSOR_GLYPH 127
 #define SCREEN_HEIGHT 24
 #define SCREEN_WIDTH 40
@@ -23,6 +21,9 @@
 #define HIRES_OFF_SWITCH ((uint8_t *) 49238U)
 #define HIRES_ON_SWITCH ((uint8_t *) 49239U)
 
+// Powers of ten for converting integers to decimal, largest first.
+static const uint16_t POWERS_OF_TEN[] = { 10000, 1000, 100, 10 };
+
 /**
  * Run-time stack of FOR loops.
  */
@@ -41,8 +42,11 @@ typedef struct {
 } ForInfo;
 
 // Location of cursor in logical screen space.
-uint16_t g_cursor_x;
-uint16_t g_cursor_y;
+uint8_t g_cursor_x;
+uint8_t g_cursor_y;
+// Memory location of the start of the cursor's row. Kept in sync with
+// g_cursor_y so that printing doesn't have to recompute it per character.
+uint8_t *g_cursor_line = TEXT_PAGE1_BASE;
 // Whether the cursor is being displayed.
 uint16_t g_showing_cursor;
 // Character at the cursor location.
@@ -67,6 +71,11 @@ uint8_t g_for_count;
 uint16_t g_arrays[MAX_ARRAY_WORDS];
 uint16_t g_arrays_size;
 
+// Number of elements of each array allocated at run time, by index in
+// g_variables, for bounds checks. Zero for an array that hasn't been
+// DIM'ed.
+uint16_t g_array_limits[MAX_VARIABLES];
+
 /**
  * Clear the FOR stack.
  */
@@ -82,6 +91,10 @@ void initialize_runtime(void) {
     memset((void *) FIRST_VARIABLE, 0, MAX_VARIABLES*2);
     clear_for_stack();
     g_arrays_size = 0;
+    memset(g_array_limits, 0, sizeof(g_array_limits));
+    if (*(uint16_t *) RND_SEED == 0) {
+        *(uint16_t *) RND_SEED = 1;
+    }
 }
 
 /**
@@ -98,7 +111,7 @@ static uint8_t *screen_pos(uint16_t x, uint16_t y) {
  * Return the memory location of the cursor.
  */
 uint8_t *cursor_pos(void) {
-    return screen_pos(g_cursor_x, g_cursor_y);
+    return g_cursor_line + g_cursor_x;
 }
 
 /**
@@ -132,6 +145,7 @@ void move_cursor(int16_t x, int16_t y) {
     hide_cursor();
     g_cursor_x = x;
     g_cursor_y = y;
+    g_cursor_line = screen_pos(0, y);
 }
 
 /**
@@ -150,15 +164,10 @@ void clear_to_eol(void) {
  */
 void home(void) {
     if (g_gr_mode) {
-        int i;
-
-        for (i = MIXED_GRAPHICS_HEIGHT; i < SCREEN_HEIGHT; i++) {
-            memset(screen_pos(0, i), CLEAR_CHAR, SCREEN_WIDTH);
-        }
-
+        clear_text_window();
         move_cursor(0, MIXED_GRAPHICS_HEIGHT);
     } else {
-        memset(TEXT_PAGE1_BASE, CLEAR_CHAR, SCREEN_STRIDE*8);
+        clear_text_screen();
         move_cursor(0, 0);
     }
 }
@@ -168,32 +177,27 @@ void home(void) {
  * row. Does not affect the cursor.
  */
 static void scroll_up(void) {
-    int i;
-    int first_line = g_gr_mode ? MIXED_GRAPHICS_HEIGHT : 0;
-    uint8_t *previous_line = 0;
-
-    for (i = first_line; i < SCREEN_HEIGHT; i++) {
-        uint8_t *this_line = screen_pos(0, i);
-        if (i > first_line) {
-            memmove(previous_line, this_line, SCREEN_WIDTH);
-        }
-        previous_line = this_line;
+    if (g_gr_mode) {
+        scroll_text_window();
+    } else {
+        scroll_text_screen();
     }
-
-    memset(previous_line, CLEAR_CHAR, SCREEN_WIDTH);
 }
 
 /**
- * Print a single newline.
+ * Print a single newline. Like all the print functions, this assumes
+ * that the cursor is hidden. The REPL hides it before running any
+ * compiled code, so compiled programs never pay for cursor bookkeeping.
  */
 void print_newline(void) {
+    g_cursor_x = 0;
+
     if (g_cursor_y == SCREEN_HEIGHT - 1) {
-        // Scroll.
-        hide_cursor();
+        // Scroll. The cursor stays on the same row.
         scroll_up();
-        move_cursor(0, g_cursor_y);
     } else {
-        move_cursor(0, g_cursor_y + 1);
+        g_cursor_y += 1;
+        g_cursor_line = screen_pos(0, g_cursor_y);
     }
 }
 
@@ -201,19 +205,43 @@ void print_newline(void) {
  * Prints the character and advances the cursor. Handles newlines.
  */
 void print_char(uint8_t c) {
-    uint8_t *loc = cursor_pos();
-
     if (c == '\n') {
         print_newline();
     } else {
         // Print character.
-        *loc = c | 0x80;
+        g_cursor_line[g_cursor_x] = c | 0x80;
 
         // Advance cursor or wrap.
-        if (g_cursor_x == SCREEN_WIDTH - 1) {
+        if (++g_cursor_x == SCREEN_WIDTH) {
+            print_newline();
+        }
+    }
+}
+
+/**
+ * Print a run of characters at the cursor. The run must not contain
+ * newlines. Characters are written straight into the current row, and
+ * the row address is only recomputed when we wrap to the next line.
+ */
+void print_chars(uint8_t *s, uint8_t length) {
+    while (length > 0) {
+        uint8_t *line = g_cursor_line;
+        uint8_t x = g_cursor_x;
+        uint8_t count = SCREEN_WIDTH - x;
+
+        if (count > length) {
+            count = length;
+        }
+        length -= count;
+        g_cursor_x = x + count;
+
+        while (count > 0) {
+            line[x++] = *s++ | 0x80;
+            count -= 1;
+        }
+
+        if (g_cursor_x == SCREEN_WIDTH) {
             print_newline();
-        } else {
-            move_cursor(g_cursor_x + 1, g_cursor_y);
         }
     }
 }
@@ -222,8 +250,21 @@ void print_char(uint8_t c) {
  * Print a string at the cursor.
  */
 void print(uint8_t *s) {
-    while (*s != '\0') {
-        print_char(*s++);
+    uint8_t *run = s;
+
+    while (1) {
+        if (*s == '\n' || *s == '\0') {
+            // Flush the run of characters before the newline or nul.
+            if (s != run) {
+                print_chars(run, s - run);
+            }
+            if (*s == '\0') {
+                break;
+            }
+            print_newline();
+            run = s + 1;
+        }
+        s += 1;
     }
 }
 
@@ -231,39 +272,35 @@ void print(uint8_t *s) {
  * Print an unsigned integer.
  */
 void print_uint(uint16_t i) {
-    // Is this the best way to do this? I've seen it done backwards, where
-    // digits are added to a buffer least significant digit first, then reversed,
-    // but this seems faster.
-    char printed = 0;
-
-    if (i >= 10000) {
-        int16_t r = i / 10000;
-        print_char('0' + r);
-        i -= r*10000;
-        printed = 1;
-    }
-    if (i >= 1000 || printed) {
-        int16_t r = i / 1000;
-        print_char('0' + r);
-        i -= r*1000;
-        printed = 1;
-    }
-    if (i >= 100 || printed) {
-        int16_t r = i / 100;
-        print_char('0' + r);
-        i -= r*100;
-        printed = 1;
-    }
-    if (i >= 10 || printed) {
-        int16_t r = i / 10;
-        print_char('0' + r);
-        i -= r*10;
+    // Each digit is found by repeatedly subtracting its power of ten, which
+    // is much cheaper on the 6502 than dividing. Digits are collected into a
+    // buffer and printed as a single run.
+    uint8_t buffer[5];
+    uint8_t *d = buffer;
+    uint8_t p;
+
+    for (p = 0; p < sizeof(POWERS_OF_TEN)/sizeof(POWERS_OF_TEN[0]); p++) {
+        uint16_t power = POWERS_OF_TEN[p];
+        uint8_t digit = '0';
+
+        while (i >= power) {
+            i -= power;
+            digit += 1;
+        }
+
+        // Skip leading zeros.
+        if (digit != '0' || d != buffer) {
+            *d++ = digit;
+        }
     }
-    print_char('0' + i);
+    *d++ = '0' + i;
+
+    print_chars(buffer, d - buffer);
 }
 
 /**
- * Print a signed integer.
+ * Print a signed integer. Compiled code calls print_int_fast in
+ * statements.s instead.
  */
 void print_int(int16_t i) {
     if ((i & 0x8000) != 0) {
@@ -274,6 +311,43 @@ void print_int(int16_t i) {
     print_uint((uint16_t) i);
 }
 
+/**
+ * Print a signed 8.8 fixed-point number, rounded to two decimal places.
+ */
+void print_fixed(int16_t f) {
+    uint16_t i = f;
+    uint8_t buffer[3];
+    uint8_t hundredths;
+
+    if ((i & 0x8000) != 0) {
+        print_char('-');
+        i = -i;
+    }
+
+    // Round the fraction to hundredths, carrying into the integer part.
+    hundredths = ((i & 0xFF)*100 + 128) >> 8;
+    i >>= 8;
+    if (hundredths == 100) {
+        hundredths = 0;
+        i += 1;
+    }
+
+    print_uint(i);
+
+    if (hundredths != 0) {
+        buffer[0] = '.';
+        buffer[1] = '0';
+        while (hundredths >= 10) {
+            hundredths -= 10;
+            buffer[1] += 1;
+        }
+        buffer[2] = '0' + hundredths;
+
+        // Drop trailing zero.
+        print_chars(buffer, hundredths == 0 ? 2 : 3);
+    }
+}
+
 /**
  * Print an error message, optionally with a line number if it's
  * not INVALID_LINE_NUMBER.
@@ -318,6 +392,13 @@ void next_without_for_error(uint16_t line_number) {
     generic_error_message("NEXT WITHOUT FOR", line_number);
 }
 
+/**
+ * Display an error for a RETURN or POP without a matching GOSUB.
+ */
+void return_without_gosub_error(uint16_t line_number) {
+    generic_error_message("RETURN WITHOUT GOSUB", line_number);
+}
+
 /**
  * Display an error for when the user does a DIM on a variable a second time.
  */
@@ -325,12 +406,33 @@ void redimd_array_error(uint16_t line_number) {
     generic_error_message("REDIM'D ARRAY", line_number);
 }
 
+/**
+ * Display an error for an array index out of bounds.
+ */
+void bad_subscript_error(uint16_t line_number) {
+    generic_error_message("BAD SUBSCRIPT", line_number);
+}
+
+/**
+ * Display an error for a READ past the last DATA item.
+ */
+void out_of_data_error(uint16_t line_number) {
+    generic_error_message("OUT OF DATA", line_number);
+}
+
+/**
+ * Divide two 8.8 fixed-point numbers. Multiplication doesn't need a C
+ * version, it's mulfix in math.s.
+ */
+int16_t div_fixed(int16_t a, int16_t b) {
+    return (int16_t) (((int32_t) a << 8) / b);
+}
+
 /**
  * Switch to graphics mode.
  */
 void gr_statement(void) {
     if (!g_gr_mode) {
-        int i;
         // Mixed text and lo-res graphics mode.
 
         hide_cursor();
@@ -339,9 +441,7 @@ void gr_statement(void) {
         *MIXED_ON_SWITCH = 0;
 
         // Clear the graphics area.
-        for (i = 0; i < MIXED_GRAPHICS_HEIGHT; i++) {
-            memset(screen_pos(0, i), 0, SCREEN_WIDTH);
-        }
+        clear_gr_screen();
 
         // Move the cursor to the text window.
         if (g_cursor_y < MIXED_GRAPHICS_HEIGHT) {
@@ -367,7 +467,7 @@ void text_statement(void) {
 }
 
 /**
- * Set the low-res color.
+ * Set the low-res color. Compiled code calls color_fast in screen.s instead.
  */
 void color_statement(uint16_t color) {
     g_gr_color_high = (uint8_t) ((color << 4) & 0xF0);
@@ -375,7 +475,8 @@ void color_statement(uint16_t color) {
 }
 
 /**
- * Plot a pixel in low-res graphics mode.
+ * Plot a pixel in low-res graphics mode. Compiled code calls plot_fast
+ * in screen.s instead.
  */
 void plot_statement(uint16_t x, uint16_t y) {
     uint8_t *pos = screen_pos(x, y >> 1);
@@ -428,7 +529,8 @@ static void remove_for_info(uint16_t var_address) {
 }
 
 /**
- * Push a FOR statement on the stack.
+ * Push a FOR statement on the stack. Compiled code calls for_fast in
+ * statements.s instead.
  */
 void for_statement(uint16_t line_number, uint16_t var_address, int16_t end_value, int16_t step,
         uint16_t loop_top_addr) {
@@ -452,7 +554,8 @@ void for_statement(uint16_t line_number, uint16_t var_address, int16_t end_value
 
 /**
  * Handle a NEXT statement. Returns the address to jump to at the top of the loop,
- * or zero to not jump.
+ * or zero to not jump. Compiled code calls next_fast in statements.s instead,
+ * which also honors negative steps.
  */
 uint16_t next_statement(uint16_t line_number, uint16_t var_address) {
     ForInfo *f;
@@ -498,7 +601,8 @@ uint16_t next_statement(uint16_t line_number, uint16_t var_address) {
 
 /**
  * Allocate an array. Size is in words, and var_addr points to
- * the variable that will store the array location.
+ * the variable that will store the array location. Compiled code calls
+ * allocate_array_fast in statements.s instead.
  */
 void allocate_array(uint16_t size, uint16_t var_addr) {
     // Actual size is one more. DIM X(10) allocates 11-entry array.
@@ -511,5 +615,6 @@ void allocate_array(uint16_t size, uint16_t var_addr) {
         // Allocate next chunk.
         *(uint16_t *) var_addr = (uint16_t) (g_arrays + g_arrays_size);
         g_arrays_size += size;
+        g_array_limits[(var_addr - FIRST_VARIABLE)/2] = size;
     }
 }
@@ -14,9 +14,33 @@
 // Each variable takes two bytes (int16_t).
 #define FIRST_VARIABLE 26
 
-// Data types for variables.
+// Zero-page index of the next DATA item to READ, just past the variables.
+#define DATA_INDEX (FIRST_VARIABLE + MAX_VARIABLES*2)
+
+// Zero-page word holding the state of the RND generator, after DATA_INDEX.
+// It must never be zero.
+#define RND_SEED (DATA_INDEX + 1)
+
+// Max words for arrays.
+#define MAX_ARRAY_WORDS 2048
+
+// Data types for variables. DT_ARRAY is a flag combined with the type of
+// the array's elements, so DT_ARRAY alone is an array of integers.
 #define DT_INT 0
 #define DT_ARRAY 1
+#define DT_FIXED 2
+#define DT_BYTE 4
+#define IS_ARRAY(data_type) ((data_type) & DT_ARRAY)
+#define ELEMENT_TYPE(data_type) ((data_type) & ~DT_ARRAY)
+
+// Suffix of fixed-point variable names, such as "X!". Fixed-point values
+// are signed 8.8: an integer part in the high byte and 256ths in the low.
+#define FIXED_SUFFIX '!'
+
+// Suffix of byte variable names, such as "X@". Byte values are unsigned
+// 0 to 255 and only use the low byte of their zero-page slot. Byte arrays
+// take one byte per element.
+#define BYTE_SUFFIX '@'
 
 typedef struct {
     // The name of the variable, with the first letter in the lower byte
@@ -29,11 +53,14 @@ typedef struct {
     uint8_t data_type;
 } VarInfo;
 
-extern uint16_t g_cursor_x;
-extern uint16_t g_cursor_y;
+extern uint8_t g_cursor_x;
+extern uint8_t g_cursor_y;
 extern uint16_t g_showing_cursor;
 extern uint8_t g_cursor_ch;
 extern VarInfo g_variables[MAX_VARIABLES];
+extern uint16_t g_arrays[MAX_ARRAY_WORDS];
+extern uint16_t g_arrays_size;
+extern uint16_t g_array_limits[MAX_VARIABLES];
 
 void initialize_runtime(void);
 void clear_for_stack(void);
@@ -51,18 +78,27 @@ void allocate_array(uint16_t size, uint16_t var_addr);
 
 void print(uint8_t *s);
 void print_char(uint8_t c);
+void print_chars(uint8_t *s, uint8_t length);
 void print_uint(uint16_t i);
 void print_int(int16_t i);
+void print_fixed(int16_t f);
 void print_newline(void);
 
+int16_t div_fixed(int16_t a, int16_t b);
+
 void for_statement(uint16_t line_number, uint16_t var_address, int16_t end_value, int16_t step,
         uint16_t loop_top_addr);
 uint16_t next_statement(uint16_t line_number, uint16_t var_address);
 
 void syntax_error(uint16_t line_number);
+void out_of_memory_error(uint16_t line_number);
+void next_without_for_error(uint16_t line_number);
+void return_without_gosub_error(uint16_t line_number);
 void syntax_error_in_line(uint16_t line_number);
 void undefined_statement_error(uint16_t line_number);
 void redimd_array_error(uint16_t line_number);
+void bad_subscript_error(uint16_t line_number);
+void out_of_data_error(uint16_t line_number);
 
 void gr_statement(void);
 void text_statement(void);
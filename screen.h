@@ -0,0 +1,43 @@
+#ifndef __SCREEN_H__
+#define __SCREEN_H__
+
+#include "platform.h"
+
+// Defines the screen kernels in screen.s.
+
+// Address of the start of each text row, low and high bytes.
+extern uint8_t text_row_lo[];
+extern uint8_t text_row_hi[];
+
+// Blank the whole text screen.
+extern void clear_text_screen(void);
+
+// Blank the text window at the bottom of mixed graphics mode.
+extern void clear_text_window(void);
+
+// Set the low-res graphics area of mixed mode to black.
+extern void clear_gr_screen(void);
+
+// Scroll the whole text screen up one row, blanking the bottom row.
+extern void scroll_text_screen(void);
+
+// Scroll the text window of mixed graphics mode up one row, blanking
+// the bottom row.
+extern void scroll_text_window(void);
+
+// The following are called from compiled code and take their arguments
+// in registers. See color_statement() and plot_statement() in runtime.c
+// for the C reference versions.
+
+// COLOR= statement. The color is in A.
+extern void color_fast();
+
+// PLOT statement. X coordinate is in A, Y coordinate in Y.
+extern void plot_fast();
+
+// DRAW statement. The transparent color is in A, and the X and then Y
+// coordinates are on the hardware stack. The JSR is followed by the shape's
+// address (two bytes), columns, rows, and row stride.
+extern void draw_fast();
+
+#endif // __SCREEN_H__
@@ -0,0 +1,296 @@
+; ---------------------------------------------------------------------------
+; screen.s
+; ---------------------------------------------------------------------------
+;
+; Kernels for clearing and scrolling the text and low-res screen, and for
+; the lo-res statements called from compiled code. The address of every
+; row is fixed, so the clear and scroll kernels are a single loop over the
+; columns with one absolute-indexed store per row, fully unrolled.
+; See the companion header file screen.h.
+
+.export   _clear_text_screen, _clear_text_window, _clear_gr_screen
+.export   _scroll_text_screen, _scroll_text_window
+.export   _text_row_lo, _text_row_hi
+.export   _color_fast, _plot_fast, _draw_fast
+
+.import   _g_gr_color_high, _g_gr_color_low
+.importzp ptr1, ptr2, tmp1
+
+; These must match runtime.c.
+SCREEN_WIDTH          = 40
+SCREEN_HEIGHT         = 24
+MIXED_TEXT_HEIGHT     = 4
+MIXED_GRAPHICS_HEIGHT = SCREEN_HEIGHT - MIXED_TEXT_HEIGHT
+CLEAR_CHAR            = ' ' | $80
+
+; Address of the start of a row of text page 1.
+.define TEXT_ROW(row) ($0400 + ((row) .mod 8)*$80 + ((row) / 8)*SCREEN_WIDTH)
+
+; Store A into column Y of rows "first" to "last" inclusive.
+.macro    fill_rows first, last
+          .repeat (last) - (first) + 1, I
+          STA     TEXT_ROW((first) + I),Y
+          .endrep
+.endmacro
+
+; Copy column Y of rows "first" + 1 to "last" up one row, then blank
+; column Y of row "last".
+.macro    scroll_rows first, last
+          .repeat (last) - (first), I
+          LDA     TEXT_ROW((first) + I + 1),Y
+          STA     TEXT_ROW((first) + I),Y
+          .endrep
+          LDA     #CLEAR_CHAR
+          STA     TEXT_ROW(last),Y
+.endmacro
+
+.segment  "BSS"
+
+; State of the shape being drawn by DRAW.
+draw_x:         .res 1
+draw_y:         .res 1
+draw_columns:   .res 1
+draw_rows:      .res 1
+draw_stride:    .res 1
+draw_clear:     .res 1
+
+.segment  "RODATA"
+
+; Address of the start of each text row.
+_text_row_lo:
+          .repeat SCREEN_HEIGHT, I
+          .byte   <TEXT_ROW(I)
+          .endrep
+_text_row_hi:
+          .repeat SCREEN_HEIGHT, I
+          .byte   >TEXT_ROW(I)
+          .endrep
+
+.segment  "CODE"
+
+; ---------------------------------------------------------------------------
+; Blank the whole text screen. Unlike a memset of the page, this leaves the
+; screen holes alone.
+
+_clear_text_screen:
+          LDA     #CLEAR_CHAR
+          LDY     #SCREEN_WIDTH - 1
+@loop:    fill_rows 0, SCREEN_HEIGHT - 1
+          DEY
+          BPL     @loop
+          RTS
+
+; ---------------------------------------------------------------------------
+; Blank the text window at the bottom of mixed graphics mode.
+
+_clear_text_window:
+          LDA     #CLEAR_CHAR
+          LDY     #SCREEN_WIDTH - 1
+@loop:    fill_rows MIXED_GRAPHICS_HEIGHT, SCREEN_HEIGHT - 1
+          DEY
+          BPL     @loop
+          RTS
+
+; ---------------------------------------------------------------------------
+; Set the low-res graphics area of mixed mode to black.
+
+_clear_gr_screen:
+          LDA     #0
+          LDY     #SCREEN_WIDTH - 1
+@loop:    fill_rows 0, MIXED_GRAPHICS_HEIGHT - 1
+          DEY
+          BPL     @loop
+          RTS
+
+; ---------------------------------------------------------------------------
+; Scroll the whole text screen up one row, blanking the bottom row. The
+; loop body is too long for a relative branch back to the top.
+
+_scroll_text_screen:
+          LDY     #SCREEN_WIDTH - 1
+@loop:    scroll_rows 0, SCREEN_HEIGHT - 1
+          DEY
+          BMI     @done
+          JMP     @loop
+@done:    RTS
+
+; ---------------------------------------------------------------------------
+; Scroll the text window of mixed graphics mode up one row, blanking the
+; bottom row.
+
+_scroll_text_window:
+          LDY     #SCREEN_WIDTH - 1
+@loop:    scroll_rows MIXED_GRAPHICS_HEIGHT, SCREEN_HEIGHT - 1
+          DEY
+          BPL     @loop
+          RTS
+
+; ---------------------------------------------------------------------------
+; COLOR= statement. The color is in A.
+
+_color_fast:
+          AND     #$0F
+          STA     _g_gr_color_low
+          ASL     A
+          ASL     A
+          ASL     A
+          ASL     A
+          STA     _g_gr_color_high
+          RTS
+
+; ---------------------------------------------------------------------------
+; PLOT statement. X coordinate is in A, Y coordinate in Y. Pixels off the
+; bottom of the screen are ignored.
+
+_plot_fast:
+          CPY     #SCREEN_HEIGHT*2
+          BCS     @done
+          STA     tmp1
+          TYA
+          LSR     A               ; Text row, with the odd/even bit in carry.
+          TAY
+          LDA     _text_row_lo,Y
+          STA     ptr1
+          LDA     _text_row_hi,Y
+          STA     ptr1+1
+          LDY     tmp1
+          BCS     @odd
+
+          ; Even, low nybble.
+          LDA     (ptr1),Y
+          AND     #$F0
+          ORA     _g_gr_color_low
+          STA     (ptr1),Y
+@done:    RTS
+
+          ; Odd, high nybble.
+@odd:     LDA     (ptr1),Y
+          AND     #$0F
+          ORA     _g_gr_color_high
+          STA     (ptr1),Y
+          RTS
+
+; ---------------------------------------------------------------------------
+; DRAW statement. Copies a shape of colors, one byte per pixel, to the
+; low-res screen, leaving the pixels of the transparent color alone. The
+; transparent color is in A, and the Y and X coordinates of the top-left
+; pixel were pushed on the hardware stack before the JSR, Y last. The JSR
+; is followed by the address of the shape (two bytes), its number of
+; columns, its number of rows, and the number of bytes from one row to the
+; next. Pixels off the right or bottom of the screen are clipped.
+
+_draw_fast:
+          AND     #$0F
+          STA     draw_clear
+          PLA                     ; Return address.
+          STA     ptr1
+          PLA
+          STA     ptr1+1
+          PLA
+          STA     draw_y
+          PLA
+          STA     draw_x
+
+          ; Inline arguments.
+          LDY     #1
+          LDA     (ptr1),Y
+          STA     ptr2
+          INY
+          LDA     (ptr1),Y
+          STA     ptr2+1
+          INY
+          LDA     (ptr1),Y
+          STA     draw_columns
+          INY
+          LDA     (ptr1),Y
+          STA     draw_rows
+          INY
+          LDA     (ptr1),Y
+          STA     draw_stride
+
+          ; Return to the last argument byte, since RTS adds one.
+          CLC
+          TYA
+          ADC     ptr1
+          TAX
+          LDA     ptr1+1
+          ADC     #0
+          PHA
+          TXA
+          PHA
+
+          ; Clip on the right.
+          LDA     draw_x
+          CMP     #SCREEN_WIDTH
+          BCS     @done
+          SBC     #SCREEN_WIDTH - 1 ; Carry is clear, so this is x - 40.
+          EOR     #$FF            ; Columns left on the screen, 40 - x.
+          ADC     #1
+          CMP     draw_columns
+          BCS     @row
+          STA     draw_columns
+
+          ; Point ptr1 at the shape's left column of the screen row. Y is
+          ; then the column for both the shape and the screen.
+@row:     LDA     draw_y
+          CMP     #SCREEN_HEIGHT*2
+          BCS     @done
+          LSR     A
+          TAY
+          CLC
+          LDA     _text_row_lo,Y
+          ADC     draw_x
+          STA     ptr1
+          LDA     _text_row_hi,Y
+          ADC     #0
+          STA     ptr1+1
+          LDA     draw_y
+          LSR     A               ; Odd row in carry.
+          LDY     draw_columns
+          DEY
+          BCS     @odd
+
+          ; Even, low nybble.
+@even:    LDA     (ptr2),Y
+          AND     #$0F
+          CMP     draw_clear
+          BEQ     @even_next
+          STA     tmp1
+          LDA     (ptr1),Y
+          AND     #$F0
+          ORA     tmp1
+          STA     (ptr1),Y
+@even_next:
+          DEY
+          BPL     @even
+          BMI     @next
+
+          ; Odd, high nybble.
+@odd:     LDA     (ptr2),Y
+          AND     #$0F
+          CMP     draw_clear
+          BEQ     @odd_next
+          ASL     A
+          ASL     A
+          ASL     A
+          ASL     A
+          STA     tmp1
+          LDA     (ptr1),Y
+          AND     #$0F
+          ORA     tmp1
+          STA     (ptr1),Y
+@odd_next:
+          DEY
+          BPL     @odd
+
+          ; Next row of the shape and of the screen.
+@next:    CLC
+          LDA     ptr2
+          ADC     draw_stride
+          STA     ptr2
+          BCC     :+
+          INC     ptr2+1
+:         INC     draw_y
+          DEC     draw_rows
+          BNE     @row
+@done:    RTS
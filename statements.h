@@ -0,0 +1,71 @@
+#ifndef __STATEMENTS_H__
+#define __STATEMENTS_H__
+
+// Defines the statement routines in statements.s. These are called from
+// compiled code and take their arguments in registers or inline after the
+// JSR, not on the cc65 argument stack, so they can't be called from C.
+// The functions in runtime.c without the _fast suffix are the C reference
+// versions.
+
+// FOR statement. The step is in AX and the end value was pushed on the
+// hardware stack, low byte first. The JSR is followed by the loop
+// variable's zero-page address (one byte) and the line number (two bytes).
+extern void for_fast();
+
+// NEXT statement. The JSR is followed by the loop variable's zero-page
+// address (one byte, zero for the most recent loop) and the line number
+// (two bytes).
+extern void next_fast();
+
+// Allocate an array. The DIM size is in AX and the array variable's
+// zero-page address is in Y.
+extern void allocate_array_fast();
+
+// Allocate a byte array. Same arguments as allocate_array_fast().
+extern void allocate_byte_array_fast();
+
+// Call the machine language routine whose address is in AX.
+extern void call_ax();
+
+// Fill memory with the byte in A. The address and the number of bytes are
+// on the cc65 stack.
+extern void fill_memory();
+
+// Fill memory with the word in AX. The address and the number of bytes are
+// on the cc65 stack.
+extern void fill_word_memory();
+
+// Copy memory, handling overlap. The source and destination addresses are
+// on the cc65 stack, and the number of bytes is in AX.
+extern void move_memory();
+
+// Print the signed integer in AX.
+extern void print_int_fast();
+
+// Called at the start of the compiled program, so that a run-time error
+// can abort it from anywhere.
+extern void enter_program();
+
+// Jump here to end the compiled program from anywhere, such as after an
+// error inside a subroutine.
+extern void abort_program();
+
+// Array index out of bounds. The JSR is followed by the line number (two
+// bytes). Prints the error and aborts the program.
+extern void bad_subscript_error_fast();
+
+// READ past the last DATA item. Same arguments as bad_subscript_error_fast().
+extern void out_of_data_error_fast();
+
+// GOSUB nested too deeply. Same arguments as bad_subscript_error_fast().
+extern void out_of_memory_error_fast();
+
+// RETURN or POP outside of a GOSUB. Same arguments as
+// bad_subscript_error_fast().
+extern void return_without_gosub_error_fast();
+
+// Hardware stack pointer at the top level of the compiled program, below
+// its own return address. It's lower inside a GOSUB.
+extern uint8_t program_stack;
+
+#endif // __STATEMENTS_H__
@@ -0,0 +1,644 @@
+; ---------------------------------------------------------------------------
+; statements.s
+; ---------------------------------------------------------------------------
+;
+; Hand-written versions of the hot statement routines that compiled code
+; calls. These don't use the cc65 argument stack: values come in A/X/Y,
+; and the variable address and line number of FOR and NEXT are stored
+; inline after the JSR. The C versions in runtime.c are the reference
+; implementations. See the companion header file statements.h.
+
+.export   _for_fast, _next_fast, _allocate_array_fast, _allocate_byte_array_fast
+.export   _print_int_fast, _enter_program, _bad_subscript_error_fast
+.export   _out_of_data_error_fast, _out_of_memory_error_fast, _abort_program
+.export   _return_without_gosub_error_fast, _program_stack
+.export   _call_ax, _fill_memory, _fill_word_memory, _move_memory
+
+.import   _g_for_count, _g_arrays, _g_arrays_size, _g_array_limits
+.import   _print, _print_chars
+.import   _out_of_memory_error, _next_without_for_error, _bad_subscript_error
+.import   _out_of_data_error, _return_without_gosub_error
+.import   pushax, popax
+.importzp sp, ptr1, ptr2, ptr3, tmp1, tmp2, tmp3
+
+; These must match runtime.c and runtime.h.
+MAX_FOR         = 10
+MAX_ARRAY_WORDS = 2048
+FIRST_VARIABLE  = 26
+
+; Offsets of the inline arguments from the return address of the JSR.
+ARG_VAR_ADDR    = 1
+ARG_LINE_NUMBER = 2
+ARG_END         = 4
+
+.segment  "BSS"
+
+; Run-time stack of FOR loops, as parallel arrays indexed by loop. The
+; count is shared with runtime.c so that clear_for_stack() resets it.
+for_var:        .res MAX_FOR
+for_end_lo:     .res MAX_FOR
+for_end_hi:     .res MAX_FOR
+for_step_lo:    .res MAX_FOR
+for_step_hi:    .res MAX_FOR
+for_top_lo:     .res MAX_FOR
+for_top_hi:     .res MAX_FOR
+
+; Digits of a number being printed, plus sign.
+digits:         .res 6
+
+; Hardware and cc65 stack pointers of the compiled program's top level.
+; Compiled code compares the hardware one to find whether it's in a GOSUB.
+_program_stack: .res 1
+saved_sp:       .res 2
+
+.segment  "RODATA"
+
+powers_lo:      .byte <10000, <1000, <100, <10
+powers_hi:      .byte >10000, >1000, >100, >10
+
+too_many:       .byte "Too many arrays.", $0A, $00
+
+.segment  "CODE"
+
+; ---------------------------------------------------------------------------
+; Pull the return address of a JSR with inline arguments into ptr1.
+
+.macro    pull_return_address
+          PLA
+          STA     ptr1
+          PLA
+          STA     ptr1+1
+.endmacro
+
+; ---------------------------------------------------------------------------
+; Jump to the code after the inline arguments, whose return address is
+; in ptr1.
+
+.macro    skip_inline_arguments
+          CLC
+          LDA     ptr1
+          ADC     #ARG_END
+          STA     ptr1
+          BCC     :+
+          INC     ptr1+1
+:         JMP     (ptr1)
+.endmacro
+
+; ---------------------------------------------------------------------------
+; Tail-call an error routine with the inline line number, arranging for it
+; to return to the code after the inline arguments.
+
+.macro    inline_error routine
+          CLC
+          LDA     ptr1
+          ADC     #ARG_END - 1
+          TAX
+          LDA     ptr1+1
+          ADC     #0
+          PHA
+          TXA
+          PHA
+          LDY     #ARG_LINE_NUMBER + 1
+          LDA     (ptr1),Y
+          TAX
+          DEY
+          LDA     (ptr1),Y
+          JMP     routine
+.endmacro
+
+; ---------------------------------------------------------------------------
+; Save the DIM size in AX plus one, the number of elements, in ptr2.
+; Preserves A, X, and Y.
+
+.macro    save_limit
+          PHA
+          CLC
+          ADC     #1
+          STA     ptr2
+          TXA
+          ADC     #0
+          STA     ptr2+1
+          PLA
+.endmacro
+
+; ---------------------------------------------------------------------------
+; Called first thing by the compiled program. Remembers the stack pointers
+; so that a run-time error can abort the program from the middle of a
+; statement.
+
+_enter_program:
+          TSX
+          INX                     ; Skip our own return address.
+          INX
+          STX     _program_stack
+          LDA     sp
+          STA     saved_sp
+          LDA     sp+1
+          STA     saved_sp+1
+          RTS
+
+; ---------------------------------------------------------------------------
+; Return from the compiled program, whatever is on the stacks.
+
+_abort_program:
+          LDX     _program_stack
+          TXS
+          LDA     saved_sp
+          STA     sp
+          LDA     saved_sp+1
+          STA     sp+1
+          RTS
+
+; ---------------------------------------------------------------------------
+; Call an error routine with the line number that follows the JSR, then
+; abort the program.
+
+.macro    abort_error routine
+          pull_return_address
+          LDY     #2              ; High byte of the line number.
+          LDA     (ptr1),Y
+          TAX
+          DEY
+          LDA     (ptr1),Y
+          JSR     routine
+          JMP     _abort_program
+.endmacro
+
+; ---------------------------------------------------------------------------
+; Array index out of bounds, from a bounds check compiled in checked mode.
+
+_bad_subscript_error_fast:
+          abort_error _bad_subscript_error
+
+; ---------------------------------------------------------------------------
+; READ past the last DATA item.
+
+_out_of_data_error_fast:
+          abort_error _out_of_data_error
+
+; ---------------------------------------------------------------------------
+; GOSUB nested too deeply for the hardware stack.
+
+_out_of_memory_error_fast:
+          abort_error _out_of_memory_error
+
+; ---------------------------------------------------------------------------
+; RETURN or POP outside of a GOSUB.
+
+_return_without_gosub_error_fast:
+          abort_error _return_without_gosub_error
+
+; ---------------------------------------------------------------------------
+; Find the FOR loop whose variable address is in A, searching from the most
+; recent. Returns with its index in Y and the carry clear, or the carry set
+; if there's no such loop.
+
+find_for:
+          LDY     _g_for_count
+@loop:    DEY
+          BMI     @not_found
+          CMP     for_var,Y
+          BNE     @loop
+          CLC
+          RTS
+@not_found:
+          SEC
+          RTS
+
+; ---------------------------------------------------------------------------
+; FOR statement. The step is in AX and the end value is on the hardware
+; stack under the return address, high byte on top. The loop variable's
+; address and the line number follow the JSR. The top of the loop is the
+; code right after them.
+
+_for_fast:
+          STA     tmp1            ; Step.
+          STX     tmp2
+          pull_return_address
+          PLA
+          STA     ptr2+1          ; End value.
+          PLA
+          STA     ptr2
+
+          LDY     #ARG_VAR_ADDR
+          LDA     (ptr1),Y
+          STA     tmp3
+
+          ; First, kill any existing loop for this variable by shifting the
+          ; rest of the stack over it.
+          JSR     find_for
+          BCS     @push
+@remove:  INY
+          CPY     _g_for_count
+          BCS     @removed
+          LDA     for_var,Y
+          STA     for_var-1,Y
+          LDA     for_end_lo,Y
+          STA     for_end_lo-1,Y
+          LDA     for_end_hi,Y
+          STA     for_end_hi-1,Y
+          LDA     for_step_lo,Y
+          STA     for_step_lo-1,Y
+          LDA     for_step_hi,Y
+          STA     for_step_hi-1,Y
+          LDA     for_top_lo,Y
+          STA     for_top_lo-1,Y
+          LDA     for_top_hi,Y
+          STA     for_top_hi-1,Y
+          JMP     @remove
+@removed: DEC     _g_for_count
+
+          ; Add the loop to our stack.
+@push:    LDY     _g_for_count
+          CPY     #MAX_FOR
+          BCS     @overflow
+          LDA     tmp3
+          STA     for_var,Y
+          LDA     ptr2
+          STA     for_end_lo,Y
+          LDA     ptr2+1
+          STA     for_end_hi,Y
+          LDA     tmp1
+          STA     for_step_lo,Y
+          LDA     tmp2
+          STA     for_step_hi,Y
+          INC     _g_for_count
+
+          ; Record the top of the loop and continue there.
+          CLC
+          LDA     ptr1
+          ADC     #ARG_END
+          STA     for_top_lo,Y
+          STA     ptr1
+          LDA     ptr1+1
+          ADC     #0
+          STA     for_top_hi,Y
+          STA     ptr1+1
+          JMP     (ptr1)
+
+@overflow:
+          inline_error _out_of_memory_error
+
+; ---------------------------------------------------------------------------
+; NEXT statement. The loop variable's address (or zero for the most recent
+; loop) and the line number follow the JSR. Jumps to the top of the loop
+; or continues after the inline arguments.
+
+_next_fast:
+          pull_return_address
+          LDY     #ARG_VAR_ADDR
+          LDA     (ptr1),Y
+          BEQ     @most_recent
+          JSR     find_for
+          BCC     @found
+          BCS     @error
+@most_recent:
+          LDY     _g_for_count
+          DEY
+          BMI     @error
+
+          ; Pop off every loop above us in the stack.
+@found:   INY
+          STY     _g_for_count
+          DEY
+
+          ; Step the loop variable.
+          LDX     for_var,Y
+          CLC
+          LDA     0,X
+          ADC     for_step_lo,Y
+          STA     0,X
+          LDA     1,X
+          ADC     for_step_hi,Y
+          STA     1,X
+
+          ; Signed compare against the end value, in the direction of the
+          ; step. The N flag ends up set if we've gone past the end.
+          LDA     for_step_hi,Y
+          BMI     @negative
+          LDA     for_end_lo,Y
+          CMP     0,X
+          LDA     for_end_hi,Y
+          SBC     1,X
+          JMP     @compare
+@negative:
+          LDA     0,X
+          CMP     for_end_lo,Y
+          LDA     1,X
+          SBC     for_end_hi,Y
+@compare: BVC     @no_overflow
+          EOR     #$80
+@no_overflow:
+          BMI     @done
+
+          ; Loop back to the top.
+          LDA     for_top_lo,Y
+          STA     ptr1
+          LDA     for_top_hi,Y
+          STA     ptr1+1
+          JMP     (ptr1)
+
+          ; We're done, remove our FOR loop and continue after the NEXT.
+@done:    DEC     _g_for_count
+          skip_inline_arguments
+
+@error:   inline_error _next_without_for_error
+
+; ---------------------------------------------------------------------------
+; Allocate a byte array. Same arguments as _allocate_array_fast. A DIM size
+; of n needs n + 1 bytes, which round up to n/2 + 1 words, so halve the
+; size and allocate that many words.
+
+_allocate_byte_array_fast:
+          save_limit
+          STA     tmp1
+          TXA
+          LSR     A
+          TAX
+          LDA     tmp1
+          ROR     A
+          JMP     allocate_words
+
+; ---------------------------------------------------------------------------
+; Allocate an array. The DIM size is in AX (the array has one more entry
+; than that) and the zero-page address of the array variable is in Y. The
+; number of elements goes in g_array_limits for bounds checks.
+
+_allocate_array_fast:
+          save_limit
+allocate_words:
+          STY     tmp1
+          CLC
+          ADC     #1
+          BCC     @compute_end
+          INX
+@compute_end:
+          ; New total size, in words.
+          CLC
+          ADC     _g_arrays_size
+          STA     ptr1
+          TXA
+          ADC     _g_arrays_size+1
+          STA     ptr1+1
+          BCS     @error
+          LDA     #<MAX_ARRAY_WORDS
+          CMP     ptr1
+          LDA     #>MAX_ARRAY_WORDS
+          SBC     ptr1+1
+          BCC     @error
+
+          ; Store the address of the next free word in the variable.
+          LDA     _g_arrays_size
+          ASL     A
+          STA     tmp2
+          LDA     _g_arrays_size+1
+          ROL     A
+          TAY
+          LDX     tmp1
+          CLC
+          LDA     tmp2
+          ADC     #<_g_arrays
+          STA     0,X
+          TYA
+          ADC     #>_g_arrays
+          STA     1,X
+
+          LDA     ptr2
+          STA     _g_array_limits - FIRST_VARIABLE,X
+          LDA     ptr2+1
+          STA     _g_array_limits - FIRST_VARIABLE + 1,X
+
+          LDA     ptr1
+          STA     _g_arrays_size
+          LDA     ptr1+1
+          STA     _g_arrays_size+1
+          RTS
+
+@error:   LDA     #<too_many
+          LDX     #>too_many
+          JMP     _print
+
+; ---------------------------------------------------------------------------
+; FILL statement. The address and the number of bytes are on the cc65
+; stack, and the byte to fill with is in A. Whole pages are filled four
+; bytes per loop, then the rest of the last page from the top down.
+
+_fill_memory:
+          STA     tmp1
+          JSR     popax
+          STA     ptr3
+          STX     ptr3+1
+          JSR     popax
+          STA     ptr1
+          STX     ptr1+1
+          LDA     tmp1
+          LDX     ptr3+1
+          BEQ     @partial
+          LDY     #0
+@page:
+          .repeat 4
+          STA     (ptr1),Y
+          INY
+          .endrep
+          BNE     @page
+          INC     ptr1+1
+          DEX
+          BNE     @page
+@partial: LDY     ptr3
+          BEQ     @done
+@byte:    DEY
+          STA     (ptr1),Y
+          BNE     @byte
+@done:    RTS
+
+; ---------------------------------------------------------------------------
+; FILL of a word array. The address and the number of bytes are on the cc65
+; stack, and the word to fill with is in AX. Stores the first word, then
+; copies each word to the next one up.
+
+_fill_word_memory:
+          STA     tmp1
+          STX     tmp2
+          JSR     popax
+          STA     ptr3
+          STX     ptr3+1
+          JSR     popax
+          STA     ptr1
+          STX     ptr1+1
+          LDA     ptr3
+          ORA     ptr3+1
+          BEQ     @done
+          LDY     #0
+          LDA     tmp1
+          STA     (ptr1),Y
+          INY
+          LDA     tmp2
+          STA     (ptr1),Y
+          CLC
+          LDA     ptr1
+          ADC     #2
+          STA     ptr2
+          LDA     ptr1+1
+          ADC     #0
+          STA     ptr2+1
+          SEC
+          LDA     ptr3
+          SBC     #2
+          STA     ptr3
+          LDA     ptr3+1
+          SBC     #0
+          STA     ptr3+1
+          JMP     move_up
+@done:    RTS
+
+; ---------------------------------------------------------------------------
+; MOVE statement. The source and destination addresses are on the cc65
+; stack, and the number of bytes is in AX. Copies from the top down if the
+; destination is above the source, so that overlapping ranges work.
+
+_move_memory:
+          STA     ptr3
+          STX     ptr3+1
+          JSR     popax
+          STA     ptr2
+          STX     ptr2+1
+          JSR     popax
+          STA     ptr1
+          STX     ptr1+1
+          CMP     ptr2
+          LDA     ptr1+1
+          SBC     ptr2+1
+          BCC     move_down
+
+          ; Copy ptr3 bytes from ptr1 to ptr2, from the bottom up. Whole
+          ; pages are copied two bytes per loop.
+move_up:
+          LDY     #0
+          LDX     ptr3+1
+          BEQ     @byte
+@page:
+          .repeat 2
+          LDA     (ptr1),Y
+          STA     (ptr2),Y
+          INY
+          .endrep
+          BNE     @page
+          INC     ptr1+1
+          INC     ptr2+1
+          DEX
+          BNE     @page
+@byte:    CPY     ptr3
+          BEQ     @done
+          LDA     (ptr1),Y
+          STA     (ptr2),Y
+          INY
+          BNE     @byte           ; Always, Y is below ptr3.
+@done:    RTS
+
+          ; Same from the top down, starting with the partial last page.
+move_down:
+          CLC
+          LDA     ptr1+1
+          ADC     ptr3+1
+          STA     ptr1+1
+          CLC
+          LDA     ptr2+1
+          ADC     ptr3+1
+          STA     ptr2+1
+          LDX     ptr3+1
+          LDY     ptr3
+          BEQ     @pages
+@byte:    DEY
+          LDA     (ptr1),Y
+          STA     (ptr2),Y
+          TYA
+          BNE     @byte
+@pages:   TXA
+          BEQ     @done
+@page:    DEC     ptr1+1
+          DEC     ptr2+1
+          LDY     #0
+@loop:
+          .repeat 2
+          DEY
+          LDA     (ptr1),Y
+          STA     (ptr2),Y
+          .endrep
+          TYA
+          BNE     @loop
+          DEX
+          BNE     @page
+@done:    RTS
+
+; ---------------------------------------------------------------------------
+; CALL statement with a computed address in AX. The routine's RTS returns
+; to the compiled code.
+
+_call_ax:
+          STA     ptr1
+          STX     ptr1+1
+          JMP     (ptr1)
+
+; ---------------------------------------------------------------------------
+; Print the signed integer in AX. Digits are found by repeated subtraction
+; of powers of ten and printed as a single run.
+
+_print_int_fast:
+          STA     ptr1
+          STX     ptr1+1
+          LDY     #0              ; Length of the digit buffer.
+          TXA
+          BPL     @positive
+          LDA     #'-'
+          STA     digits
+          INY
+          SEC
+          LDA     #0
+          SBC     ptr1
+          STA     ptr1
+          LDA     #0
+          SBC     ptr1+1
+          STA     ptr1+1
+@positive:
+          STY     tmp2            ; Where the first digit goes.
+          LDX     #0              ; Index of power of ten.
+@power:   LDA     #'0'
+          STA     tmp1            ; Digit.
+@subtract:
+          LDA     ptr1
+          CMP     powers_lo,X
+          LDA     ptr1+1
+          SBC     powers_hi,X
+          BCC     @digit
+          STA     ptr1+1
+          LDA     ptr1
+          SBC     powers_lo,X     ; Carry is still set.
+          STA     ptr1
+          INC     tmp1
+          BNE     @subtract       ; Always taken.
+@digit:   LDA     tmp1
+          CPY     tmp2            ; Skip leading zeros.
+          BNE     @store
+          CMP     #'0'
+          BEQ     @next_power
+@store:   STA     digits,Y
+          INY
+@next_power:
+          INX
+          CPX     #4
+          BCC     @power
+
+          ; Ones digit is what's left.
+          LDA     ptr1
+          ORA     #'0'
+          STA     digits,Y
+          INY
+
+          ; print_chars(digits, length).
+          TYA
+          PHA
+          LDA     #<digits
+          LDX     #>digits
+          JSR     pushax
+          PLA
+          JMP     _print_chars